@@ -1,25 +1,68 @@
 #include <stdio.h>
+#include <math.h>
 #include "pico/stdlib.h"
+#include "hardware/structs/timer.h"
 
 #include "config.h"
 #include "util.hpp"
 #include "taps.hpp"
 #include "CActuator.hpp"
+#include "CCoreLink.hpp"
 
-static constexpr int ENABLE_DELAY_MS = 20;
+//
+// How far (in full speed microseconds) does the actuator go when the motor is on for 'onUs', counting
+//  from the start of the ramp up?  If 'stopped', include the ramp back down.  Ramps are taken to be linear
+//
+static int rampTravelUs( int onUs, bool stopped ) {
+	const float up = MOTOR_RAMP_UP_MS * 1000.0f, down = MOTOR_RAMP_DOWN_MS * 1000.0f;
+	const float duty = (up <= 0 || onUs >= up) ? 1.0f : onUs / up;		// how fast we got before stopping
+
+	float travel = (onUs >= up) ? onUs - up/2 : onUs * duty / 2;
+	if( stopped )
+		travel += duty * duty * down / 2;
+	return int( travel );
+}
+
+//
+// The inverse of rampTravelUs( onUs, true ):  how long must the motor be on to go 'travel'?
+//
+static int rampOnTimeUs( int travel ) {
+	const float up = MOTOR_RAMP_UP_MS * 1000.0f, down = MOTOR_RAMP_DOWN_MS * 1000.0f;
+	const float travelAtFullSpeed = up/2 + down/2;
+
+	if( travel >= travelAtFullSpeed )
+		return int( travel + up/2 - down/2 );
+	return int( sqrtf( travel / travelAtFullSpeed ) * up );
+}
 
-CActuator::CActuator( int fullTransitMs ) :
+//
+// Sanity check a motion model, in particular one learned by watching the owner press a button
+//
+bool CActuator::isValidMotion( const motion_t& m ) {
+	const int nominalUs = ACTUATOR_FULL_TRANSIT_MS * 1000;
+	return  m.extendUs >= nominalUs / 3 && m.extendUs <= maxStrokeUs() &&
+			m.retractUs >= nominalUs / 3 && m.retractUs <= maxStrokeUs() &&
+			m.startLagUs >= 0 && m.startLagUs <= 1000000 &&
+			m.stopLagUs >= 0 && m.stopLagUs <= 1000000;
+}
+
+CActuator::CActuator( const motion_t& motion ) :
 	m_MOTOR_ENABLE( BoardPin::MOTOR_ENABLE ),
 	m_LPWM( BoardPin::MOTOR_LPWM ),
 	m_RPWM( BoardPin::MOTOR_RPWM ),
+	m_leftPWM( m_LPWM, MOTOR_PWM_FREQ ),
+	m_rightPWM( m_RPWM, MOTOR_PWM_FREQ ),
 
-	m_fullTransitMs( fullTransitMs ),
-	m_fullTransitMsToBeSure( (11*fullTransitMs)/10 ),
+	m_motion( motion ),
     m_moved( false ),
-	m_currentDirection( 0 )
+	m_currentDirection( 0 ),
+	m_rampTick( *this ),
+	m_stopAlarm( *this )
 
 {
 	stopMotion();
+	m_MOTOR_ENABLE = true;			// both inputs low with the bridge enabled is a brake
+	CLOCKOUT_OTHER_CORE::addWatch( parkedWatch, this );
 }
 
 void CActuator::setMoved( bool moved ) {
@@ -27,88 +70,213 @@ void CActuator::setMoved( bool moved ) {
 }
 
 //
-// Low level start extending the actuator
+// Low level start moving the actuator; 1 extends, -1 retracts.  The ramp timer takes it from here
 //
-void CActuator::startExtendMotion() {
-	m_MOTOR_ENABLE = false;
-	if( ENABLE_DELAY_MS )
-		sleep_ms( ENABLE_DELAY_MS );
-	m_LPWM = false;
-	m_RPWM = true;
-	m_MOTOR_ENABLE = true;
-	m_currentDirection = 1;
+void CActuator::startMotion( int8_t direction ) {
+	CINTERRUPTS_OFF intsOff;
+	m_startTime.clear();
+	m_stopAfterUs = -1;
+	m_cut = false;
+	m_currentDirection = direction;
+	m_wantDirection = direction;
+	rampStep();
+	m_rampTick.start();
     setMoved( true );
 }
 
 //
-// Low level start retracting the actuator
+// Low level stop moving the actuator.  The motor is ramped down from here
 //
-void CActuator::startRetractMotion() {
-	m_MOTOR_ENABLE = false;
-	if( ENABLE_DELAY_MS )
-		sleep_ms( ENABLE_DELAY_MS );
-	m_RPWM = false;
-	m_LPWM = true;
-	m_MOTOR_ENABLE = true;
-	m_currentDirection = -1;
-    setMoved( true );
+void CActuator::stopMotion() {
+	CINTERRUPTS_OFF intsOff;
+	m_motorStoppedAt = m_cut ? m_cutAt : get_absolute_time();
+	if( m_cut ) {
+		//
+		// cutMotor() already braked it.  Ramping down from the old duty would drive the motor again first
+		//
+		m_duty = 0;
+		m_driveDirection = 0;
+	}
+	m_cut = false;
+	m_stopArmed = false;
+	m_stopAfterUs = -1;
+	m_currentDirection = 0;
+	m_wantDirection = 0;
+	rampStep();
+	m_rampTick.start();
 }
 
 //
-// Low level stop moving the actuator
+// Move the H-bridge duty cycle one step toward where we want to be.  Called from the ramp timer
 //
-void CActuator::stopMotion() {
-	m_MOTOR_ENABLE = false;
-	m_LPWM = m_RPWM = false;
-	m_MOTOR_ENABLE = true;			// brake
-	m_currentDirection = 0;
+void CActuator::rampStep() {
+	const float upStep = MOTOR_RAMP_UP_MS > MOTOR_RAMP_STEP_MS ? (100.0f * MOTOR_RAMP_STEP_MS) / MOTOR_RAMP_UP_MS : 100;
+	const float downStep = MOTOR_RAMP_DOWN_MS > MOTOR_RAMP_STEP_MS ? (100.0f * MOTOR_RAMP_STEP_MS) / MOTOR_RAMP_DOWN_MS : 100;
+
+	if( m_driveDirection != m_wantDirection ) {
+		if( (m_duty -= downStep) <= 0 || m_driveDirection == 0 ) {
+			m_duty = 0;
+			m_driveDirection = m_wantDirection;
+		}
+	} else if( m_driveDirection != 0 ) {
+		m_duty = MIN( m_duty + upStep, 100 );
+	}
+
+	//
+	// The motion starts, as far as position is concerned, when we start ramping up in the right direction
+	//
+	if( m_driveDirection != 0 && m_driveDirection == m_wantDirection && m_startTime == false ) {
+		m_startTime.setNow();
+		if( m_stopAfterUs >= 0 )
+			armStop();
+	}
+
+	if( m_cut )
+		m_duty = 0;				// cutMotor() stopped us; stay stopped until halt() catches up
+
+	m_rightPWM.setPercent( m_driveDirection > 0 ? m_duty : 0 );
+	m_leftPWM.setPercent( m_driveDirection < 0 ? m_duty : 0 );
+
+	if( m_driveDirection == m_wantDirection && m_duty == (m_driveDirection != 0 ? 100 : 0) )
+		m_rampTick.stop();
 }
 
 void CActuator::extend( bool updateGauge ) {
+	m_stopAlarm.cancel();
+	halt();
 	m_lastStopTime.clear();
 	startExtendMotion();
-	m_startTime.setNow();
 	if( updateGauge )
 		m_gaugeUpdater.start();
 }
 
 void CActuator::retract( bool updateGauge ) {
+	m_stopAlarm.cancel();
+	halt();
 	m_lastStopTime.clear();
 	startRetractMotion();
-	m_startTime.setNow();
 	if( updateGauge )
 		m_gaugeUpdater.start();
 }
 
 void CActuator::startFullRetract( bool updateGauge ) {
+	m_stopAlarm.cancel();
+	halt();
 	m_lastStopTime.clear();
-	m_currentPositionMs = 0;
+	m_currentPositionUs = 0;
 	startRetractMotion();
-	m_startTime.setNow();
+	stopAfter( fullRetractUsToBeSure() );
 
 	if( updateGauge )
 		m_gaugeUpdater.start( CMessage::Type::FULL_RETRACT );
 }
 
-void CActuator::stop() {
-	if( !active() )
+bool CActuator::moveTo( float percent, bool updateGauge ) {
+	stop();
+
+	int targetUs = int( m_motion.extendUs * (percent/100) );
+	targetUs = MAX( targetUs, 0 );
+	targetUs = MIN( targetUs, m_motion.extendUs );
+
+	const int deltaUs = targetUs - m_currentPositionUs;
+	const int onUs = onTimeUs( deltaUs > 0 ? 1 : -1, abs( deltaUs ) );
+	if( onUs <= 0 )
+		return false;
+
+	if( deltaUs > 0 )
+		extend( updateGauge );
+	else
+		retract( updateGauge );
+
+	stopAfter( onUs );
+	return true;
+}
+
+//
+// Stop the motor 'us' after it starts ramping up.  If it is still ramping down from going the other
+//  way, rampStep() arms the alarm once it gets going
+//
+void CActuator::stopAfter( int us ) {
+	CINTERRUPTS_OFF intsOff;
+	m_stopAfterUs = us;
+	if( m_startTime == true )
+		armStop();
+}
+
+void CActuator::armStop() {
+	auto when = delayed_by_us( m_startTime.when(), m_stopAfterUs );
+	m_stopAfterUs = -1;
+	while( !m_stopAlarm.at( when ) )
+		when = make_timeout_time_us( 10 );			// already late...stop as soon as we can
+	m_stopDeadline = uint32_t( to_us_since_boot( when ) );
+	m_stopArmed = true;
+}
+
+void __not_in_flash_func(CActuator::cutMotor)() {
+	if( m_cut )
 		return;
+	m_rightPWM.forceOff();
+	m_leftPWM.forceOff();
+
+	uint32_t hi, lo;
+	do {
+		hi = timer_hw->timerawh;
+		lo = timer_hw->timerawl;
+	} while( hi != timer_hw->timerawh );
+	m_cutAt = from_us_since_boot( (uint64_t(hi) << 32) | lo );
+	m_cut = true;
+}
+
+//
+// Called over and over while we're parked.  The stop alarm can't fire, so watch the clock for it
+//
+void __not_in_flash_func(CActuator::parkedWatch)( void *context ) {
+	auto& me = *static_cast< CActuator * >( context );
+	if( me.m_stopArmed && int32_t( timer_hw->timerawl - me.m_stopDeadline ) >= 0 )
+		me.cutMotor();
+}
+
+//
+// Stop the motor and account for how far it went.  Safe at interrupt time.  Returns false
+//  if the motor wasn't running
+//
+bool CActuator::halt() {
+	CINTERRUPTS_OFF intsOff;
+
+	if( !active() )
+		return false;
 
 	const bool retracting = (m_currentDirection < 0);
 
+	const bool started = (m_startTime == true);
 	stopMotion();
-	auto runTime = m_startTime.ms();
+	const int onUs = started ? int( absolute_time_diff_us( m_startTime.when(), m_motorStoppedAt ) ) : 0;
+	const int travel = travelUs( retracting ? -1 : 1, onUs, true );
 
-	m_lastStopTime.setNow();
+	m_lastStopTime.set( m_motorStoppedAt );
 
-	m_currentPositionMs += retracting ? -runTime : runTime;
-	m_currentPositionMs = MAX( m_currentPositionMs, 0 );
-	m_currentPositionMs = MIN( m_currentPositionMs, m_fullTransitMs );
+	m_currentPositionUs += retracting ? -travel : travel;
+	m_currentPositionUs = MAX( m_currentPositionUs, 0 );
+	m_currentPositionUs = MIN( m_currentPositionUs, m_motion.extendUs );
 
 	m_startTime.clear();
 	m_gaugeUpdater.stop();
+	return true;
+}
 
-	printf("Actuator Stop: %d mS, %.2f%%\n", m_currentPositionMs, percent() );
+void CActuator::stop() {
+	m_stopAlarm.cancel();
+	if( halt() )
+		printf("Actuator Stop: %.3f mS, %.2f%%\n", m_currentPositionUs / 1000.0f, percent() );
+}
+
+//
+// Called at interrupt time when a timed move is due to finish
+//
+void CActuator::onMoveDeadline() {
+	if( halt() )
+		if( auto msg = CMessage::alloc( CMessage::Type::ACTUATOR_DONE ) )
+			msg->push();
 }
 
 int CActuator::secondsSinceLastStop() const {
@@ -116,10 +284,12 @@ int CActuator::secondsSinceLastStop() const {
 }
 
 float CActuator::percentUnbounded() const {
-	int position = m_currentPositionMs;
-	if( active() )
-		position += (m_currentDirection < 0) ? -m_startTime.ms() : m_startTime.ms();
-	float unboundedPercent =  (position*100.0f) / m_fullTransitMs;
+	int position = m_currentPositionUs;
+	if( active() && m_startTime == true ) {
+		const int travel = travelUs( m_currentDirection, m_startTime.us(), false );
+		position += (m_currentDirection < 0) ? -travel : travel;
+	}
+	float unboundedPercent =  (position*100.0f) / m_motion.extendUs;
 	return unboundedPercent;
 }
 
@@ -131,5 +301,38 @@ float CActuator::percent() const {
 }
 
 void CActuator::setAlreadyAtPercent( float percent ) {
-	m_currentPositionMs = int( m_fullTransitMs * (percent/100) );
+	m_currentPositionUs = int( m_motion.extendUs * (percent/100) );
+}
+
+void CActuator::setMotion( const motion_t& m ) {
+	const float p = percent();
+	m_motion = m;
+	setAlreadyAtPercent( p );
+}
+
+//
+// How far (in extend time) does the actuator go when the motor is on for 'onUs' in 'direction'?  If 'stopped',
+//  include what happens after the motor is switched off
+//
+int CActuator::travelUs( int8_t direction, int onUs, bool stopped ) const {
+	const int movingUs = onUs - m_motion.startLagUs;
+	if( movingUs <= 0 )
+		return 0;
+
+	int travel = rampTravelUs( movingUs, stopped ) + (stopped ? m_motion.stopLagUs : 0);
+	if( direction < 0 )
+		travel = int( (int64_t(travel) * m_motion.extendUs) / m_motion.retractUs );
+	return travel;
+}
+
+//
+// The inverse of travelUs( direction, onUs, true ).  Returns 0 if the run-on alone covers 'travel'
+//
+int CActuator::onTimeUs( int8_t direction, int travel ) const {
+	if( direction < 0 )
+		travel = int( (int64_t(travel) * m_motion.retractUs) / m_motion.extendUs );
+	travel -= m_motion.stopLagUs;
+	if( travel <= 0 )
+		return 0;
+	return rampOnTimeUs( travel ) + m_motion.startLagUs;
 }
\ No newline at end of file
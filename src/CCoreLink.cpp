@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/stdio/driver.h"
+#include "pico/stdio_usb.h"
+#include "pico/multicore.h"
+#include "hardware/irq.h"
+#include "hardware/structs/sio.h"
+
+#include "util.hpp"
+#include "CCoreLink.hpp"
+
+//
+// The SDK serializes the stdio drivers with its print mutex, so only one core at a time is ever
+//   in logOutChars() and the ring keeps its single producer
+//
+static CCoreFIFO< char, 4096 >  s_log;
+static uint32_t                 s_droppedReported = 0;
+static stdio_driver_t           s_logDriver;
+
+static void logOutChars( const char *buf, int len ) {
+    while( len-- > 0 )
+        s_log.push( *buf++ );
+}
+
+//
+// Whoever is waiting for input wants to see the prompt first
+//
+static int logInChars( char *buf, int len ) {
+    CConsoleLog::drain();
+    return stdio_usb.in_chars( buf, len );
+}
+
+void CConsoleLog::install() {
+    s_logDriver.out_chars = logOutChars;
+    s_logDriver.in_chars = logInChars;
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    s_logDriver.crlf_enabled = PICO_STDIO_DEFAULT_CRLF;
+#endif
+    stdio_set_driver_enabled( &stdio_usb, false );
+    stdio_set_driver_enabled( &s_logDriver, true );
+}
+
+void CConsoleLog::drain() {
+    char buf[ 64 ];
+    int n = 0;
+
+    while( s_log.pop( buf[n] ) ) {
+        if( ++n == sizeof(buf) ) {
+            stdio_usb.out_chars( buf, n );
+            n = 0;
+        }
+    }
+    if( n )
+        stdio_usb.out_chars( buf, n );
+
+    if( const auto dropped = s_log.dropped(); dropped != s_droppedReported ) {
+        n = snprintf( buf, sizeof(buf), "\r\n[%u console bytes dropped]\r\n", dropped - s_droppedReported );
+        stdio_usb.out_chars( buf, n );
+        s_droppedReported = dropped;
+    }
+}
+
+//
+// Parking the other core.  Everything the parked core touches from here on is in RAM
+//
+static constexpr uint32_t   PARK_REQUEST = 0x50415243;     // 'PARC'
+
+static volatile bool        s_victim[ 2 ];
+static volatile bool        s_parkRequested = false;
+static volatile bool        s_parked = false;
+
+static struct {
+    CLOCKOUT_OTHER_CORE::watch_t    watch;
+    void                            *context;
+}                           s_watches[ 4 ];
+static volatile int         s_numWatches = 0;
+
+static void __not_in_flash_func(onParkRequest)() {
+    bool park = false;
+    while( sio_hw->fifo_st & SIO_FIFO_ST_VLD_BITS )
+        park |= (sio_hw->fifo_rd == PARK_REQUEST);
+    sio_hw->fifo_st = 0xFF;                             // clear the sticky FIFO error flags, and the interrupt
+
+    if( !park )
+        return;
+
+    const uint32_t intsState = save_and_disable_interrupts();
+    s_parked = true;
+    while( s_parkRequested ) {
+        for( int i = 0; i < s_numWatches; ++i )
+            s_watches[i].watch( s_watches[i].context );
+    }
+    s_parked = false;
+    restore_interrupts( intsState );
+}
+
+void CLOCKOUT_OTHER_CORE::victimInit() {
+    const uint core = get_core_num();
+    irq_set_exclusive_handler( SIO_IRQ_PROC0 + core, onParkRequest );
+    irq_set_enabled( SIO_IRQ_PROC0 + core, true );
+    s_victim[ core ] = true;
+}
+
+bool CLOCKOUT_OTHER_CORE::addWatch( watch_t watch, void *context ) {
+    CINTERRUPTS_OFF intsOff;
+    if( s_numWatches >= int( sizeof(s_watches) / sizeof(s_watches[0]) ) )
+        return false;
+    s_watches[ s_numWatches ] = { watch, context };
+    __dmb();
+    ++s_numWatches;
+    return true;
+}
+
+CLOCKOUT_OTHER_CORE::CLOCKOUT_OTHER_CORE() : m_parked( m_depth++ == 0 && s_victim[ get_core_num() ^ 1 ] ) {
+    if( m_parked ) {
+        s_parkRequested = true;
+        __dmb();
+        multicore_fifo_push_blocking( PARK_REQUEST );
+        while( !s_parked )
+            tight_loop_contents();
+    }
+}
+
+CLOCKOUT_OTHER_CORE::~CLOCKOUT_OTHER_CORE() {
+    --m_depth;
+    if( m_parked ) {
+        s_parkRequested = false;
+        while( s_parked )
+            tight_loop_contents();
+    }
+}
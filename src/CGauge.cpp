@@ -1,15 +1,19 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 
+#include "config.h"
 #include "util.hpp"
 #include "CGauge.hpp"
+#include "taps.hpp"
 
 CGauge::CGauge( const calType_t &cal, uint hz ) :
 m_gpio( BoardPin::GAUGE_PWM ),
 m_gaugeEnablePin( BoardPin::GAUGE_ENABLE, false ),
 m_notGaugeEnablePin( BoardPin::NOT_GAUGE_ENABLE, true ),
-m_gaugePWM( m_gpio, hz )
+m_gaugePWM( m_gpio, hz ),
+m_slew( *this )
 {
+	m_gaugePWM.setDither( true );
 	calibrate( cal );
 	set(0);
 }
@@ -27,10 +31,20 @@ CGauge& CGauge::disable() {
 }
 
 float CGauge::mapGaugeToDutyCycle( float gaugePercent ) const {
-    int index = int( (gaugePercent / 100) * m_dutyCycleMap.size() + 0.5f );
-    index = MAX( index, 0 );
-    index = MIN( index, int(m_dutyCycleMap.size()-1) );
-    return m_dutyCycleMap[ index ];
+	const int32_t segments = m_spline.size();
+    int32_t x = int32_t( gaugePercent * (segments * Q16_ONE / 100.0f) + 0.5f );
+    x = MAX( x, 0 );
+    x = MIN( x, segments * Q16_ONE );
+
+	const int32_t i = MIN( x >> Q16_SHIFT, segments - 1 );
+	const int64_t t = x - (i << Q16_SHIFT);
+	const segment_t& s = m_spline[ i ];
+
+	int64_t y = s.d;
+	y = s.c + ((y * t) >> Q16_SHIFT);
+	y = s.b + ((y * t) >> Q16_SHIFT);
+	y = s.a + ((y * t) >> Q16_SHIFT);
+	return float( y ) / Q16_ONE;
 }
 
 float CGauge::currentDutyCycle() const {
@@ -38,70 +52,125 @@ float CGauge::currentDutyCycle() const {
 }
 
 CGauge&	CGauge::setCurrentDutyCycle( float dutyCycle ) {
+    m_slew.stop();
     m_gaugePWM.setPercent( dutyCycle );
     return *this;
 }
 
-CGauge& CGauge::setCurrentDutyCycleSlow( const float desiredPWM ) {
-	float current;
-	while( (current = currentDutyCycle()) != desiredPWM ) {
-		sleep_ms(20);
-		float delta = current > desiredPWM ? -1.0f : 1.0f;
-		if( abs(current + delta - desiredPWM) <= 1.0f )
-			delta = desiredPWM - current;
-		setCurrentDutyCycle( current + delta );
-	}
+CGauge& CGauge::setCurrentDutyCycleSlow( const float desiredPWM, bool ease ) {
+	CINTERRUPTS_OFF intsOff;
+	if( !m_slew.enabled() )
+		m_slew.m_current = currentDutyCycle();
+	m_slew.m_target = desiredPWM;
+	m_slew.m_next = NAN;
+	m_slew.m_ease = ease;
+	m_slew.start();
 	return *this;
 }
 
+CGauge::CSlew::CSlew( CGauge& gauge ) : COnTick( GAUGE_SLEW_STEP_MS ), m_gauge( gauge ), m_current( 0 ), m_target( 0 ), m_next( NAN ), m_ease( false ) {}
+
+//
+// m_current keeps the fractions the PWM level can't, so small steps still add up
+//
+void CGauge::CSlew::onTick() {
+	constexpr float maxStep = GAUGE_SLEW_DUTY_PER_SEC * GAUGE_SLEW_STEP_MS / 1000.0f;
+	const float remaining = m_target - m_current;
+	const float step = m_ease ? MIN( maxStep, MAX( fabsf( remaining ) / 4, maxStep / 10 ) ) : maxStep;
+
+	if( fabsf( remaining ) > step ) {
+		m_current += (remaining > 0) ? step : -step;
+		m_gauge.m_gaugePWM.setPercent( m_current );
+		return;
+	}
+
+	m_current = m_target;
+	m_gauge.m_gaugePWM.setPercent( m_current );
+	if( !isnan( m_next ) ) {
+		m_target = m_next;
+		m_next = NAN;
+		return;
+	}
+
+	stop();
+	if( auto msg = CMessage::alloc( CMessage::Type::GAUGE_SLEW_DONE ) )
+		msg->push();
+}
+
 CGauge& CGauge::set( float percent ) {
 	setCurrentDutyCycle( mapGaugeToDutyCycle( percent ) );
 	m_percent = percent;
 	return *this;
 }
 
-CGauge& CGauge::setSlow( float percent ) {
-	setCurrentDutyCycleSlow( mapGaugeToDutyCycle( percent ) );
+CGauge& CGauge::setSlow( float percent, bool ease ) {
+	setCurrentDutyCycleSlow( mapGaugeToDutyCycle( percent ), ease );
 	m_percent = percent;
 	return *this;
 }
 
+CGauge& CGauge::thenSlow( float percent ) {
+	{
+		CINTERRUPTS_OFF intsOff;
+		if( m_slew.enabled() ) {
+			m_slew.m_next = mapGaugeToDutyCycle( percent );
+			m_percent = percent;
+			return *this;
+		}
+	}
+	return setSlow( percent );
+}
+
 //
 // Pass pwm duty cycle setpoints for 0%, 25%, 50%, 75%, and 100% gauge readings
 //
 void CGauge::calibrate( const calType_t &settings ) {
-	const auto rangeDelta = (m_dutyCycleMap.size()-1) / (settings.size()-1);
-	for( uint i = 0; i < settings.size()-1; ++i )
-		fillBetween( i*rangeDelta, settings[i], (i+1)*rangeDelta, settings[i+1] );
-
+	m_cal = settings;
     smooth();
 #if 0
-	int i = 0;
-	for( auto val : m_dutyCycleMap ) {
-		printf("%.2f ", val );
-		if( ++i % 10 == 0 )
+	for( int percent = 0; percent <= 100; ++percent ) {
+		printf("%.2f ", mapGaugeToDutyCycle( percent ) );
+		if( percent % 10 == 9 )
 			printf("\n");
 	}
 	printf("\n");
 #endif
 }
 
-void CGauge::fillBetween( int low, float dutyLow, int high, float dutyHigh) {
-	const auto deltaY = dutyHigh - dutyLow;
-	const float deltaX = float(high - low);
-
-	for( auto i = low; i <= high; ++i )
-		m_dutyCycleMap[i] = dutyLow + ((i - low)/deltaX) * deltaY;
-}
-
 //
-// Make sure the gauge map is reasonably smooth.  The only "abrupt" places might
-//  be at the 0, 25, 50, and 75% "knees".  But whatever..
+// Fit the spline through the knots.  The slopes at the knots are Fritsch-Carlson's (the harmonic mean of the
+//   neighbouring segments, or flat at a peak or valley), so the curve never overshoots a knot and a monotone
+//   calibration gives a monotone gauge.  The knots are evenly spaced, so the slopes are per segment
 //
 void CGauge::smooth() {
-    /*
-     * maybe later
-     */
+	constexpr int knots = std::tuple_size< calType_t >::value;
+	float delta[ knots - 1 ];
+	float slope[ knots ];
+
+	for( int i = 0; i < knots - 1; ++i )
+		delta[i] = m_cal[i+1] - m_cal[i];
+
+	for( int i = 1; i < knots - 1; ++i )
+		slope[i] = (delta[i-1] * delta[i] > 0) ? 2 * delta[i-1] * delta[i] / (delta[i-1] + delta[i]) : 0;
+
+	auto endSlope = []( float d0, float d1 ) {
+		float slope = (3 * d0 - d1) / 2;
+		if( slope * d0 <= 0 )
+			return 0.0f;
+		if( d0 * d1 < 0 && fabsf( slope ) > fabsf( 3 * d0 ) )
+			return 3 * d0;
+		return slope;
+	};
+	slope[0] = endSlope( delta[0], delta[1] );
+	slope[knots-1] = endSlope( delta[knots-2], delta[knots-3] );
+
+	auto q16 = []( float v ) { return int32_t( lroundf( v * Q16_ONE ) ); };
+	for( int i = 0; i < knots - 1; ++i ) {
+		m_spline[i].a = q16( m_cal[i] );
+		m_spline[i].b = q16( slope[i] );
+		m_spline[i].c = q16( 3 * delta[i] - 2 * slope[i] - slope[i+1] );
+		m_spline[i].d = q16( slope[i] + slope[i+1] - 2 * delta[i] );
+	}
 }
 
 //
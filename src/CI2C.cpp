@@ -1,28 +1,46 @@
 #include <stdio.h>
 #include <stdarg.h>
-#include <cstring>
 #include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 
 #include    "util.hpp"
 
-CI2C::CI2C( uint8_t sevenBitAddr, BoardPin::type_t sdaPin, uint hz ) :
+CI2C::CI2C( uint8_t sevenBitAddr, BoardPin::type_t sdaPin, uint maxHz ) :
  m_7BitAddr( sevenBitAddr ),
  m_available( HAL::hasPin( sdaPin ) ),
  m_sdaPin( HAL::pinNumber(sdaPin) ),
  m_sclPin( HAL::pinNumber(sdaPin) + 1 ),
- m_i2c( (HAL::pinNumber(sdaPin)&02) ? i2c1 : i2c0)
+ m_i2c( (HAL::pinNumber(sdaPin)&02) ? i2c1 : i2c0),
+ m_hz( 0 ),
+ m_stats(),
+ m_deadline( *this )
 {
     if( available() ) {
-        i2c_init( m_i2c, hz );
-        gpio_set_function( m_sdaPin, GPIO_FUNC_I2C );
-        gpio_set_function( m_sclPin, GPIO_FUNC_I2C );
         gpio_pull_up( m_sdaPin );
         gpio_pull_up( m_sclPin );
+        m_hz = maxHz;
+        recoverBus();               // in case we were reset in the middle of a transfer
+        negotiate( maxHz );
+
+        m_rxDMA = dma_claim_unused_channel( true );
+
+        const uint index = i2c_hw_index( m_i2c );
+        m_owners[ index ] = this;
+        i2c_get_hw( m_i2c )->intr_mask = 0;
+        irq_set_exclusive_handler( I2C0_IRQ + index, index ? onInterrupt1 : onInterrupt0 );
+        irq_set_enabled( I2C0_IRQ + index, true );
     }
 }
 
 CI2C::~CI2C() {
     if( available() ) {
+        if( busy() )
+            finish( false );
+        irq_set_enabled( I2C0_IRQ + i2c_hw_index( m_i2c ), false );
+        m_owners[ i2c_hw_index( m_i2c ) ] = nullptr;
+        dma_channel_unclaim( m_rxDMA );
+
         i2c_deinit( m_i2c );
         gpio_set_function( m_sdaPin, GPIO_FUNC_NULL );
         gpio_set_function( m_sclPin, GPIO_FUNC_NULL );
@@ -32,74 +50,257 @@ CI2C::~CI2C() {
 }
 
 //
-// Write 'writeData1' of 'bytesToWrite1' to the slave, followed by 'writeData2' of 'bytesToWrite2'.
-//   If 'sendStop' then issue a stop when the writes are complete.
+// Try the bus at 'maxHz' and then at the standard speeds below it, settling on the first one the slave acks a
+//   one byte read at.  If it never does, we stay at the slowest and the transactions report the errors
+//
+uint CI2C::negotiate( uint maxHz ) {
+    const uint speeds[] = { maxHz, 400 * 1000, 100 * 1000 };
+
+    for( const uint hz : speeds ) {
+        if( hz > maxHz )
+            continue;
+        m_hz = i2c_set_baudrate( m_i2c, hz );
+
+        uint8_t rxdata;
+        if( i2c_read_timeout_us( m_i2c, m_7BitAddr, &rxdata, 1, false, probeTimeout_us ) == 1 )
+            break;
+    }
+    return m_hz;
+}
+
+void CI2C::timed( uint64_t startUs, uint bytes, bool success ) {
+    const uint32_t us = uint32_t( time_us_64() - startUs );
+
+    ++m_stats.count;
+    if( !success )
+        ++m_stats.failed;
+    m_stats.lastBytes = bytes;
+    m_stats.lastUs = us;
+    m_stats.maxUs = MAX( m_stats.maxUs, us );
+    m_stats.totalUs += us;
+}
+
+void CI2C::printStats() const {
+    printf( "i2c%d addr x%x at %u Hz: health %u, %u transactions, %u failed", m_i2c == i2c0 ? 0 : 1, m_7BitAddr, m_hz, m_health,
+            m_stats.count, m_stats.failed );
+    if( m_stats.count )
+        printf( "; last %u bytes in %u uS, average %u uS, max %u uS", m_stats.lastBytes, m_stats.lastUs,
+                uint32_t( m_stats.totalUs / m_stats.count ), m_stats.maxUs );
+    printf( "\n" );
+}
+
 //
-// Either 'bytesToWrite1' or 'bytesToWrite2' can be zero
+// Nine clocks a byte, plus the address byte
 //
+uint32_t CI2C::defaultTimeoutUs( uint bytes ) const {
+    return uint32_t( 2 * (bytes + 1) * 9 * 1000000ull / MAX( m_hz, 1u ) ) + 1000;
+}
+
 bool
-CI2C::writeWrite( const void *writeData1, uint8_t bytesToWrite1, const void *writeData2, uint16_t bytesToWrite2, bool sendStop ) {
+CI2C::startWriteWrite( const void *writeData1, uint8_t bytesToWrite1, const void *writeData2, uint16_t bytesToWrite2, uint32_t timeoutUs ) {
+    const segment_t segments[] = { { writeData1, bytesToWrite1 }, { writeData2, bytesToWrite2 } };
+    return start( segments, 2, nullptr, 0, timeoutUs );
+}
+
+bool
+CI2C::startWriteRead( const void *writeData, uint8_t bytesToWrite, void *readData, uint16_t bytesToRead, uint32_t timeoutUs ) {
+    const segment_t segments[] = { { writeData, bytesToWrite } };
+    return start( segments, 1, readData, bytesToRead, timeoutUs );
+}
+
+bool CI2C::startWriteGather( const segment_t *segments, uint count, uint32_t timeoutUs ) {
+    return start( segments, count, nullptr, 0, timeoutUs );
+}
+
+//
+// Point the I2C block at our slave, fill the TX FIFO and let the interrupts take it from there.  The RX DMA
+//   channel takes whatever the reads bring in
+//
+bool CI2C::start( const segment_t *segments, uint count, void *readData, uint16_t bytesToRead, uint32_t timeoutUs ) {
     if( !available() ) {
         showError( "marked unavailable\n" );
         return false;
     }
-    const uint totalBytes = bytesToWrite1 + bytesToWrite2;
-    if( totalBytes == 0 )
+
+    uint bytesToWrite = 0;
+    for( uint i = 0; i < count; ++i )
+        bytesToWrite += segments[i].bytes;
+
+    if( count > maxSegments || bytesToWrite + bytesToRead == 0 || busy() ) {
+        showError( "can't start writing %u and reading %u bytes\n", bytesToWrite, bytesToRead );
         return false;
+    }
+
+    if( m_recover ) {
+        m_recover = false;
+        if( !recoverBus() )
+            showError( "bus still stuck after recovery\n" );
+    }
 
-    if( bytesToWrite1 && bytesToWrite2 ) {
-        uint8_t buffer[ 1000 ];
-        if( totalBytes > sizeof(buffer) )
-            return false;
+    for( uint i = 0; i < count; ++i )
+        m_segments[i] = segments[i];
+    m_numSegments = count;
+    m_segment = 0;
+    m_offset = 0;
+    m_readsToSend = bytesToRead;
+    m_restartRead = bytesToWrite > 0;
+    m_toSend = bytesToWrite + bytesToRead;
 
-        memcpy( buffer, writeData1, bytesToWrite1 );
-        memcpy( buffer + bytesToWrite1, writeData2, bytesToWrite2 );
-        if( i2c_write_timeout_us( m_i2c, m_7BitAddr, buffer, totalBytes, !sendStop, CI2C::timeout_us ) < 0 ) {
-            showError( "writeWrite i2c_write_timeout_us %u bytes failed\n", totalBytes );
-            return false;
-        }
-        return true;
+    i2c_hw_t * const hw = i2c_get_hw( m_i2c );
+
+    hw->enable = 0;
+    hw->tar = m_7BitAddr;
+    hw->enable = 1;
+    (void)hw->clr_intr;
+    hw->tx_tl = 4;
+    hw->dma_rdlr = 0;
+    hw->dma_cr = bytesToRead ? I2C_IC_DMA_CR_RDMAE_BITS : 0;
+
+    if( bytesToRead ) {
+        dma_channel_config c = dma_channel_get_default_config( m_rxDMA );
+        channel_config_set_transfer_data_size( &c, DMA_SIZE_8 );
+        channel_config_set_read_increment( &c, false );
+        channel_config_set_write_increment( &c, true );
+        channel_config_set_dreq( &c, i2c_get_dreq( m_i2c, false ) );
+        dma_channel_configure( m_rxDMA, &c, readData, &hw->data_cmd, bytesToRead, true );
     }
 
-    if( bytesToWrite1 )
-        if( i2c_write_timeout_us( m_i2c, m_7BitAddr, static_cast<const uint8_t *>(writeData1), bytesToWrite1, !sendStop, CI2C::timeout_us ) < 0 ) {
-            showError( "writeWrite i2c_write_timeout_us failed; %u bytes to write for 'bytesToWrite1'\n", bytesToWrite1 );
-            return false;
+    m_state = state_t::BUSY;
+    m_timedOut = false;
+    m_startUs = time_us_64();
+    m_bytes = m_toSend;
+    m_deadline.at( make_timeout_time_us( timeoutUs ? timeoutUs : defaultTimeoutUs( m_toSend ) ) );
+
+    CINTERRUPTS_OFF intsOff;
+    feed();
+    hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS | I2C_IC_INTR_MASK_M_TX_ABRT_BITS |
+                    (m_toSend ? I2C_IC_INTR_MASK_M_TX_EMPTY_BITS : 0);
+    return true;
+}
+
+//
+// Top up the TX FIFO:  the bytes of each segment in turn, then the read commands.  The last word carries the STOP
+//
+void CI2C::feed() {
+    i2c_hw_t * const hw = i2c_get_hw( m_i2c );
+
+    for( uint space = i2c_get_write_available( m_i2c ); m_toSend && space; --space ) {
+        uint32_t cmd;
+        if( m_readsToSend == 0 || m_toSend > m_readsToSend ) {
+            while( m_offset >= m_segments[ m_segment ].bytes ) {
+                ++m_segment;
+                m_offset = 0;
+            }
+            cmd = static_cast< const uint8_t * >( m_segments[ m_segment ].data )[ m_offset++ ];
+        } else {
+            cmd = I2C_IC_DATA_CMD_CMD_BITS | (m_restartRead ? I2C_IC_DATA_CMD_RESTART_BITS : 0);
+            m_restartRead = false;
+            --m_readsToSend;
         }
+        if( --m_toSend == 0 )
+            cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+        hw->data_cmd = cmd;
+    }
+}
 
-    if( bytesToWrite2 )
-        if( i2c_write_timeout_us( m_i2c, m_7BitAddr, static_cast<const uint8_t *>(writeData2), bytesToWrite2, !sendStop, CI2C::timeout_us ) < 0 ) {
-            showError( "writeWrite i2c_write_timeout_us failed; %u bytes to write for 'bytesToWrite2'\n", bytesToWrite2 );
-            return false;
+//
+// The STOP has gone out, or the slave didn't ack, or we ran out of time.  This runs from the I2C or the alarm
+//   interrupt, whichever comes first
+//
+void CI2C::finish( bool success ) {
+    CINTERRUPTS_OFF intsOff;
+    if( m_state != state_t::BUSY )
+        return;
+
+    i2c_hw_t * const hw = i2c_get_hw( m_i2c );
+    m_deadline.cancel();
+    hw->intr_mask = 0;
+
+    if( success ) {
+        //
+        // The last byte read is in the RX FIFO at the STOP; give the DMA a moment to move it
+        //
+        for( int spin = 0; dma_channel_is_busy( m_rxDMA ); ++spin ) {
+            if( spin > 100 ) {
+                success = false;
+                break;
+            }
         }
+    }
+    if( !success ) {
+        dma_channel_abort( m_rxDMA );
+        hw->enable = 0;                 // drops whatever is left in the FIFOs
+        hw->enable = 1;
+    }
+    hw->dma_cr = 0;
+    (void)hw->clr_intr;
+    m_toSend = 0;
 
-    return true;
+    m_recover = !success;
+    m_health = success ? MIN( m_health + healthGain, 100 ) : MAX( m_health - healthLoss, 0 );
+    timed( m_startUs, m_bytes, success );
+    m_state = success ? state_t::DONE : state_t::FAILED;
+    __sev();
+}
+
+void CI2C::onInterrupt() {
+    const uint32_t raw = i2c_get_hw( m_i2c )->raw_intr_stat;
+
+    if( raw & I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS ) {
+        finish( false );
+    } else if( raw & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS ) {
+        finish( true );
+    } else if( raw & I2C_IC_RAW_INTR_STAT_TX_EMPTY_BITS ) {
+        feed();
+        if( m_toSend == 0 )
+            i2c_get_hw( m_i2c )->intr_mask &= ~I2C_IC_INTR_MASK_M_TX_EMPTY_BITS;
+    }
 }
 
 //
-// Write 'bytesToWrite' to the slave, then turn around and read 'bytesToRead'.
-//  No bytes are written if 'bytesToWrite' is zero
-//  No bytes are read if 'bytesToRead' is zero
-//  STOP is issued after the operation
+// A slave that lost its place mid byte (a brown out, a glitch on the wire) can hold SDA low for good.  Clock SCL
+//   by hand until it lets go, up to the nine clocks a byte and its ack take, send a STOP, and then hand the pins
+//   back to a freshly reset I2C block.  The pins are driven open drain:  output low, or input and pulled up
 //
-bool
-CI2C::writeRead( const void *writeData, uint8_t bytesToWrite, void *readData, uint16_t bytesToRead ) {
-    if( !available() ) {
-        showError( "marked unavailable\n" );
-        return false;
+bool CI2C::recoverBus() {
+    constexpr uint32_t halfClockUs = 5;
+
+    auto release = []( uint pin ) { gpio_set_dir( pin, GPIO_IN ); busy_wait_us_32( halfClockUs ); };
+    auto pullLow = []( uint pin ) { gpio_set_dir( pin, GPIO_OUT ); busy_wait_us_32( halfClockUs ); };
+
+    const uint pins[] = { m_sdaPin, m_sclPin };
+    for( const uint pin : pins ) {
+        gpio_set_function( pin, GPIO_FUNC_SIO );
+        gpio_put( pin, false );
+        release( pin );
     }
 
-    if( bytesToWrite )
-        if( !writeWrite( writeData, bytesToWrite, nullptr, 0, bytesToRead ? false : true ) )
-            return false;
+    for( int clock = 0; clock < 9 && gpio_get( m_sdaPin ) == false; ++clock ) {
+        pullLow( m_sclPin );
+        release( m_sclPin );
+    }
 
-    if( bytesToRead )
-        if( i2c_read_timeout_us( m_i2c, m_7BitAddr, static_cast<uint8_t *>(readData), bytesToRead, false, CI2C::timeout_us ) != bytesToRead ) {
-            showError("writeRead i2c_read_timeout_us failed; %u bytes to read\n", bytesToRead );
-            return false;
-        }
+    pullLow( m_sclPin );            // STOP:  SDA goes high while SCL is high
+    pullLow( m_sdaPin );
+    release( m_sclPin );
+    release( m_sdaPin );
+    const bool freed = gpio_get( m_sdaPin ) && gpio_get( m_sclPin );
 
-    return true;
+    i2c_init( m_i2c, m_hz );
+    gpio_set_function( m_sdaPin, GPIO_FUNC_I2C );
+    gpio_set_function( m_sclPin, GPIO_FUNC_I2C );
+    return freed;
+}
+
+bool CI2C::wait() {
+    while( busy() )
+        __wfe();
+
+    if( m_state == state_t::FAILED ) {
+        showError( "transfer of %u bytes %s\n", m_bytes, m_timedOut ? "timed out" : "aborted" );
+        return false;
+    }
+    return m_state == state_t::DONE;
 }
 
 void
@@ -120,7 +321,10 @@ void CI2C::scan() {
     printf("   0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F\n");
 
     for (int addr = 0; addr < (1 << 7); ++addr) {
-        if( bool success; ( getcharTimeout(success,0), success ) )
+        //
+        // Not getcharTimeout():  its consoleIdle could start a background transfer on the bus we're probing
+        //
+        if( getchar_timeout_us( 0 ) != PICO_ERROR_TIMEOUT )
             break;
 
         if (addr % 16 == 0)
@@ -1,59 +1,108 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
-#include "pico/critical_section.h"
 
+#include "util.hpp"
 #include "taps.hpp"
 
-static CMessage *freeList = nullptr;
-static CMessage *queueHead = nullptr, *queueTail = nullptr;
-static bool stopped = false;
-
-static class CriticalSection {
-	critical_section_t		m_critSec;
-public:
-	CriticalSection() {
-		critical_section_init( &m_critSec );
-	}
-	~CriticalSection() {
-		critical_section_deinit( &m_critSec );
-	}
+//
+// The message queue is a bounded multi-producer/single-consumer ring of message values per lane.
+//  Each slot carries a sequence number telling who may touch it:
+//
+//      m_sequence == lap           slot is free for the producer claiming position 'lap + index'
+//      m_sequence == lap + 1       slot has been published and is waiting for the consumer
+//
+//  where 'lap' is the claimed position with the index bits masked off.  Producers only contend on
+//  s_enqueuePos, and only for the length of a compareAndSwap(), so an ISR can never be held
+//  off by the main loop.  compareAndSwap() holds a hardware spinlock, so producers may be on either
+//  core.  The consumer owns s_dequeuePos outright.
+//
+// Everything is zero at startup, which is exactly "every slot free for lap 0"
+//
+CMessage CMessage::m_ring[ CMessage::NUM_LANES ][ CMessage::RING_SIZE ];
+
+static volatile uint32_t s_enqueuePos[ CMessage::NUM_LANES ];
+static uint32_t s_dequeuePos[ CMessage::NUM_LANES ];
+static volatile bool stopped = false;
+
+//
+// One bit per coalescing message type that is sitting in a lane waiting to be popped
+//
+static volatile uint32_t s_pendingTypes = 0;
+
+static volatile uint32_t s_dropped[ int(CMessage::Type::COUNT) ];
+static volatile uint32_t s_coalesced[ int(CMessage::Type::COUNT) ];
+
+static_assert( int(CMessage::Type::COUNT) <= 32, "s_pendingTypes needs a bit per type" );
+
+static inline uint32_t typeBit( CMessage::Type t ) {
+	return 1u << unsigned(t);
+}
 
-	operator critical_section_t *()	{ return &m_critSec; }
+static void clearPending( CMessage::Type t ) {
+	for( uint32_t old = s_pendingTypes; !compareAndSwap( s_pendingTypes, old, old & ~typeBit(t) ); old = s_pendingTypes )
+		;
+}
 
-} critSec;
+CMessage::Lane CMessage::laneOf( Type t ) {
+	switch( t ) {
+	case Type::TRIM_TOP_ON:
+	case Type::TRIM_BOTTOM_ON:
+	case Type::TRIM_OFF:
+	case Type::POWER_FAILED:
+	case Type::POWER_RESTORED:
+	case Type::ACTUATOR_DONE:
+		return URGENT;
+	default:
+		return NORMAL;
+	}
+}
 
-class LOCK {
-public:
-	LOCK()	{ critical_section_enter_blocking( critSec ); }
-	~LOCK()	{ critical_section_exit( critSec ); }
-};
+bool CMessage::coalesces( Type t ) {
+	return t == Type::GAUGE_UPDATE || t == Type::FULL_RETRACT || t == Type::HEARTBEAT || t == Type::LAZY_SAVE;
+}
 
 CMessage *CMessage::alloc( Type t, int optionalData ) {
-	static bool initialized = false;
-
-	LOCK l;
-
-	if( !initialized ) {
-		static CMessage messages[20];
-
-		for( auto i = 0; i < int( sizeof(messages)/sizeof(messages[0]) ) ; ++i )
-			messages[i].freeWithoutLock();
-
-		initialized = true;
-	}
-
 	if( stopped )
 		return nullptr;
 
-	if( CMessage *instance = freeList ) {
-		freeList = instance->m_next;
-		instance->m_next = nullptr;
-		instance->m_type = t;
-		instance->m_data = optionalData;
-		return instance;
+	//
+	// A periodic message already waiting covers this one too
+	//
+	if( coalesces(t) ) {
+		uint32_t old;
+		do {
+			old = s_pendingTypes;
+			if( old & typeBit(t) ) {
+				++s_coalesced[ int(t) ];
+				return nullptr;
+			}
+		} while( !compareAndSwap( s_pendingTypes, old, old | typeBit(t) ) );
 	}
 
-	return nullptr;
+	const Lane lane = laneOf( t );
+	uint32_t position = s_enqueuePos[ lane ];
+	for( ;; ) {
+		CMessage * const slot = &m_ring[ lane ][ position & RING_MASK ];
+		const int32_t diff = int32_t( slot->m_sequence - (position & ~RING_MASK) );
+
+		if( diff == 0 ) {
+			if( compareAndSwap( s_enqueuePos[ lane ], position, position + 1 ) ) {
+				slot->m_position = position;
+				slot->m_type = t;
+				slot->m_data = optionalData;
+				return slot;
+			}
+		} else if( diff < 0 ) {
+			//
+			// The consumer hasn't freed this slot from the previous lap....we're full
+			//
+			++s_dropped[ int(t) ];
+			if( coalesces(t) )
+				clearPending( t );
+			return nullptr;
+		}
+		position = s_enqueuePos[ lane ];
+	}
 }
 
 void CMessage::start() {
@@ -65,45 +114,50 @@ void CMessage::stop() {
 	flush();
 }
 
-void CMessage::freeWithoutLock() {
-	m_type = Type::FREE;
-	m_next = freeList;
-	freeList = this;
-}
-
 void CMessage::free() {
-	LOCK l;
-	freeWithoutLock();
+	m_type = Type::FREE;
+	__dmb();
+	m_sequence = (m_position & ~RING_MASK) + RING_SIZE;
 }
 
 void CMessage::push() {
-	if( !stopped ) {
-		LOCK l;
-		if( queueTail ) {
-			queueTail->m_next = this;
-			queueTail = this;
-		} else {
-			queueHead = queueTail = this;
-		}
-		this->m_next = nullptr;
-		return;
-	}
-
 	//
-	// Can't queue the message.... don't lose it!
+	// Can't queue the message.... but the slot is already claimed, so publish it as FREE
+	//  and let pop() hand it back
 	//
-	free();
+	if( stopped ) {
+		if( coalesces( m_type ) )
+			clearPending( m_type );
+		m_type = Type::FREE;
+	}
+
+	__dmb();
+	m_sequence = (m_position & ~RING_MASK) + 1;
 }
 
+//
+// Only ever called from the main loop.  Lanes are drained in priority order
+//
 CMessage *CMessage::pop() {
-	LOCK l;
-	if( CMessage *instance = queueHead ) {
-		queueHead = instance->m_next;
-		if( queueTail == instance )
-			queueTail = nullptr;
-
-		instance->m_next = nullptr;
-		return instance;
+	for( int lane = URGENT; lane < NUM_LANES; ++lane ) {
+		for( ;; ) {
+			uint32_t& position = s_dequeuePos[ lane ];
+			CMessage * const slot = &m_ring[ lane ][ position & RING_MASK ];
+			if( int32_t( slot->m_sequence - ((position & ~RING_MASK) + 1) ) < 0 )
+				break;			// nothing (more) published in this lane
+
+			++position;
+			__dmb();
+			if( slot->m_type != Type::FREE ) {
+				//
+				// Once popped, a fresh periodic message may be queued behind this one
+				//
+				if( coalesces( slot->m_type ) )
+					clearPending( slot->m_type );
+				return slot;
+			}
+			slot->free();
+		}
 	}
 	return nullptr;
 }
@@ -113,8 +167,8 @@ void CMessage::flush() {
 		msg->free();
 }
 
-void CMessage::print() const {
-	char const * const text[] = {
+static char const *typeName( CMessage::Type t ) {
+	static char const * const text[] = {
 		"FREE",
 		"TRIM_TOP_ON",
 		"TRIM_BOTTOM_ON",
@@ -125,11 +179,29 @@ void CMessage::print() const {
 		"CONFIG_BUTTON_ON",
 		"POWER_FAILED",
 		"POWER_RESTORED",
-		"USER_COMMAND"
+		"USER_COMMAND",
+		"LAZY_SAVE",
+		"ACTUATOR_DONE",
+		"NV_COMMITTED",
+		"GAUGE_SLEW_DONE",
+		"NV_ZAP",
+		"RETRACT_SETTLED"
 	};
+	static_assert( sizeof(text)/sizeof(text[0]) == size_t(CMessage::Type::COUNT), "message text out of sync with Type" );
+
+	return unsigned(t) < sizeof(text)/sizeof(text[0]) ? text[ unsigned(t) ] : nullptr;
+}
 
-	if( unsigned(m_type) < sizeof(text)/sizeof(text[0]) )
-		printf("%s\n", text[ unsigned(m_type) ] );
+void CMessage::print() const {
+	if( auto name = typeName( m_type ) )
+		printf("%s\n", name );
 	else
 		printf( "INVALID MESSAGE TYPE %d\n", int( m_type ) );
 }
+
+void CMessage::printStats() {
+	printf( "\n%-18s %6s %8s %10s\n", "Message", "Lane", "Dropped", "Coalesced" );
+	for( int t = int(Type::FREE) + 1; t < int(Type::COUNT); ++t )
+		printf( "%-18s %6s %8u %10u\n", typeName( Type(t) ), laneOf( Type(t) ) == URGENT ? "urgent" : "normal",
+				unsigned( s_dropped[t] ), coalesces( Type(t) ) ? unsigned( s_coalesced[t] ) : 0u );
+}
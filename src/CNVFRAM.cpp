@@ -5,11 +5,43 @@
 #include "config.h"
 #include "util.hpp"
 #include "CGauge.hpp"
+#include "taps.hpp"
+#include "CActuator.hpp"
 #include "CNVFRAM.hpp"
 #include "CRC.hpp"
 
-CNVFRAM::CNVFRAM( uint8_t sevenBitAddr, BoardPin::type_t sdaPin ) : CNVState( "FRAM" ), m_i2c( sevenBitAddr, sdaPin )
+CNVFRAM::CNVFRAM( uint8_t sevenBitAddr, BoardPin::type_t sdaPin ) : CNVState( "FRAM" ), m_i2c( sevenBitAddr, sdaPin, FRAM_I2C_HZ )
 {
+    record_t r, other;
+    for( int slot = 0; slot < 2; ++slot ) {
+        if( get( recordAddr( slot ), &other, RECORD_BYTES ) && other.valid() &&
+            (m_slot < 0 || int32_t( other.sequence - m_sequence ) > 0) ) {
+            r = other;
+            m_slot = slot;
+            m_sequence = r.sequence;
+        }
+    }
+    if( m_slot < 0 ) {
+        readLegacy();
+        return;
+    }
+
+    super::setDefaults();
+    if( r.reason >= super::First && r.reason <= super::Last && r.percent >= 0 && r.percent <= 100 ) {
+        super::reason().init( r.reason ).setWasValid(true);
+        super::actuatorPercent().init( r.percent ).setWasValid(true);
+    }
+    if( CGauge::isValidCalibration( r.gaugeCal ) )
+        super::gaugeCal().init( r.gaugeCal ).setWasValid(true);
+    if( CActuator::isValidMotion( r.motion ) )
+        super::motion().init( r.motion ).setWasValid(true);
+}
+
+//
+// Pick up the gauge calibration and actuator position an older build stored an item at a time.  The next write
+//   moves it all into a record_t
+//
+void CNVFRAM::readLegacy() {
     super::reason_t r;
     super::actuatorPercent_t percent;
     CCRC16::type_t storedCRC;
@@ -44,6 +76,8 @@ CNVFRAM::CNVFRAM( uint8_t sevenBitAddr, BoardPin::type_t sdaPin ) : CNVState( "F
     }
     if( !success )
         super::gaugeCal().setDefault();
+
+    super::motion().setDefault();           // the old layout never held one; it gets learned
 }
 
 uint CNVFRAM::size() const {
@@ -53,33 +87,69 @@ uint CNVFRAM::size() const {
     return 8 * 1024;
 }
 
-bool CNVFRAM::commit() {
-    if( super::gaugeCal().changed() ) {
-        const super::gaugeCal_t cal = super::gaugeCal().get();
-        const auto computedCRC = CCRC16(cal.data(), cal.size() * sizeof(*cal.data()) ).crc();
-
-        set( ADDR_GAUGE_CAL, cal.data(), cal.size() * sizeof(*cal.data()) );
-        set( ADDR_GAUGE_CAL_CRC, &computedCRC, sizeof(computedCRC) );
-        super::gaugeCal().clearChanged();
-    }
+//
+// The whole record goes out in one transaction, whatever changed, rather than an item and its CRC at a time each
+//   with its own addressing.  That's what matters after a power failure.  It goes over the older slot, so the
+//   newest record is still there if this one doesn't make it.
+//
+// DMA sends it while we get on with other things; writeDone() picks up the result
+//
+bool CNVFRAM::write( const values_t& values, uint8_t& changed ) {
+    const int slot = (m_slot == 0) ? 1 : 0;
+
+    record_t& r = m_writeRecord;
+    r = {};
+    r.version = RECORD_VERSION;
+    r.sequence = m_sequence + 1;
+    r.reason = values.reason;
+    r.percent = values.actuatorPercent;
+    r.gaugeCal = values.gaugeCal;
+    r.motion = values.motion;
+    r.crc = r.calcCRC();
+
+    const uint addr = recordAddr( slot );
+    m_writeAddr[0] = uint8_t(addr >> 8);
+    m_writeAddr[1] = uint8_t(addr);
+    if( m_i2c.startWriteWrite( m_writeAddr, sizeof( m_writeAddr ), &r, RECORD_BYTES ) == false )
+        return true;
 
-    if( super::actuatorPercent().changed() || super::reason().changed() ) {
-        const auto percent = super::actuatorPercent().get();
-        if( super::actuatorPercent().changed() )
-            set( ADDR_ACTUATOR_PERCENT, &percent, sizeof(percent) );
+    m_writingSlot = slot;
+    m_written = false;
+    return false;
+}
 
-        const auto r = super::reason().get();
-        if( super::reason().changed() )
-            set( ADDR_REASON, &r, sizeof(r) );
+bool CNVFRAM::writeDone( uint8_t& changed ) {
+    if( m_writingSlot >= 0 ) {
+        if( m_i2c.busy() )
+            return false;
+        settleWrite();
+    }
+    if( m_written )
+        changed = 0;
+    return true;
+}
 
-        const auto computedCRC = CCRC16( &percent, sizeof(percent) ).add( &r, sizeof(r) ).crc();
-        if( set( ADDR_ACTUATOR_CRC, &computedCRC, sizeof( computedCRC ) ) ) {
-            super::actuatorPercent().clearChanged();
-            super::reason().clearChanged();
-        }
+//
+// Wait out the background write, if there is one, and note how it went.  Anything else that uses the bus does
+//   this first
+//
+void CNVFRAM::finishWrite() {
+    if( m_writingSlot >= 0 ) {
+        m_i2c.wait();
+        settleWrite();
     }
+}
 
-    return true;
+//
+// Note how the background write went
+//
+void CNVFRAM::settleWrite() {
+    m_written = (m_i2c.state() == CI2C::state_t::DONE);
+    if( m_written ) {
+        m_slot = m_writingSlot;
+        ++m_sequence;
+    }
+    m_writingSlot = -1;
 }
 
 //
@@ -104,7 +174,8 @@ void CNVFRAM::zap() {
 //
 // Fetch 'numberOfBytes' into 'buf' from FRAM address 'eepromAddress'
 //
-bool CNVFRAM::get( const uint eepromAddress, void * const buf, const uint numberOfBytes ) const {
+bool CNVFRAM::get( const uint eepromAddress, void * const buf, const uint numberOfBytes ) {
+    finishWrite();
     const uint8_t framAddr[2] = { uint8_t(eepromAddress >> 8), uint8_t(eepromAddress) };
     return m_i2c.writeRead( framAddr, sizeof(framAddr), buf, numberOfBytes );
 }
@@ -113,14 +184,22 @@ bool CNVFRAM::get( const uint eepromAddress, void * const buf, const uint number
 // Put 'numberOfBytes' from 'buf' to FRAM address 'eepromAddress'
 //
 bool CNVFRAM::set( const uint eepromAddress, const void * const buf, const uint numberOfBytes ) {
+    finishWrite();
     const uint8_t framAddr[2] = { uint8_t(eepromAddress >> 8), uint8_t(eepromAddress) };
-    return m_i2c.writeWrite( framAddr, sizeof( framAddr ), buf, numberOfBytes, true );
+    return m_i2c.writeWrite( framAddr, sizeof( framAddr ), buf, numberOfBytes );
 }
 
 bool CNVFRAM::doCommand( int cmd ) {
     
     if( cmd == 'i' ) {
+        finishWrite();              // the scan drives the bus itself, and doesn't start anything new
         m_i2c.scan();
+
+        record_t r;
+        const uint64_t start = time_us_64();
+        const bool ok = get( recordAddr( MAX( m_slot, 0 ) ), &r, RECORD_BYTES );
+        printf( "\nRecord read, %u bytes: %s in %u uS\n", RECORD_BYTES, ok ? "ok" : "FAILED", uint32_t( time_us_64() - start ) );
+        m_i2c.printStats();
         return true;
     }
 
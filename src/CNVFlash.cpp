@@ -8,23 +8,47 @@
 #include "config.h"
 #include "util.hpp"
 #include "CGauge.hpp"
+#include "taps.hpp"
+#include "CActuator.hpp"
 #include "CNVFlash.hpp"
 #include "CRC.hpp"
+#include "CCoreLink.hpp"
 
 //
 // This file implements the storage of persistent data into the pico's flash.  The data is separated
 //   into infrequently changing elements and frequently changing elements.  We make a reasonable attempt
 //   to avoid wearing out the flash, and by my calculations this should work for decades of use.
 //
-// We CRC the data to make sure corruption is detected (but it is not corrected)
+// Each kind of data is an append-only log of records spread over a ring of sectors.  A save programs just
+//   the page holding the next free record (NOR flash only clears bits, so the 0xFF around it leaves the
+//   records already in that page alone).  When a sector fills up, the next sector in the ring, which holds
+//   the oldest records, is erased and the log carries on there.
 //
-template < class t, uint32_t top >
+// Each record starts with a sequence number, which is programmed first and is never all ones, so a blank
+//   sequence word means a blank slot.  The sector whose first record has the highest sequence number is the
+//   newest, and within it the records run from the start up to the first blank slot, so finding the newest
+//   record takes a look at each sector and a binary search rather than reading the whole log.
+//
+// We CRC the data to make sure corruption is detected (but it is not corrected).  A save or erase cut short
+//   by a power failure just leaves records that fail their CRC, and the previous record is still there
+//
+
+//
+// 't' is logged in 'sectors' sectors just below flash offset 'top'.  If 'legacyTop' isn't 0, the sector
+//   below it holds records in the old rewrite-the-whole-sector format, which we read if the log is empty
+//
+template < class t, uint32_t top, int sectors, uint32_t legacyTop = 0 >
 class configBase {
-    struct tWithCRC {
+    static_assert( sectors >= 2, "erasing the only sector would lose the newest record" );
+
+    static constexpr uint32_t BLANK = 0xFFFFFFFF;
+
+    struct record_t {
+        uint32_t        m_sequence;         // never BLANK once written
         t               m_data;
-        CCRC16::type_t  m_crc;
+        CCRC16::type_t  m_crc;              // of everything before it
 
-        tWithCRC()  { memset( (void *)(this), 0xFF, sizeof(*this)); }
+        record_t()  { memset( (void *)(this), 0xFF, sizeof(*this)); }
 
         bool empty() const {
             for( uint8_t const *p = (uint8_t const *)(this); p < (uint8_t const *)(this+1); ++p )
@@ -32,100 +56,199 @@ class configBase {
                     return false;
             return true;
         }
+        CCRC16::type_t  calcCRC() const     { return CCRC16( this, &m_crc ).crc(); }
+        bool            valid() const       { return calcCRC() == m_crc; }
+    };
+
+    struct legacy_t {
+        t               m_data;
+        CCRC16::type_t  m_crc;
     };
 
     const char * const m_name;
+
+    static bool     blank( int slot )       { return recordAt( slot )->m_sequence == BLANK; }
+    static bool     sectorErased( int sector );
+    static void     eraseSector( int sector );
+    static bool     program( int slot, const record_t& r );
+
 public:
-    static const int    pagesInFlash =      (sizeof(tWithCRC) + FLASH_PAGE_SIZE-1)/FLASH_PAGE_SIZE;
-    static const int    sectorsInFlash =    (pagesInFlash*FLASH_PAGE_SIZE + FLASH_SECTOR_SIZE - 1)/FLASH_SECTOR_SIZE;
-    static const auto   offsetInFlash =     top - (sectorsInFlash*FLASH_SECTOR_SIZE);
-    static const int    numConfigInFlash =  FLASH_SECTOR_SIZE / sizeof(tWithCRC);
+    static const int    recordsPerPage =    FLASH_PAGE_SIZE / sizeof(record_t);
+    static const int    recordsPerSector =  recordsPerPage * (FLASH_SECTOR_SIZE / FLASH_PAGE_SIZE);
+    static const int    numConfigInFlash =  recordsPerSector * sectors;
+    static const auto   offsetInFlash =     top - sectors * FLASH_SECTOR_SIZE;
+    static_assert( recordsPerPage > 0, "records must fit in a flash page" );
+
+    static record_t const * recordAt( int slot )    { return (record_t const *)((char *)(XIP_BASE) + offsetInFlash +
+                                                            (slot / recordsPerPage) * FLASH_PAGE_SIZE + (slot % recordsPerPage) * sizeof(record_t)); }
 
-    static auto         baseAddress()                       { return (tWithCRC const *)((char *)(XIP_BASE) + offsetInFlash); }
-    auto                calcCRC( const t * const dp ) const { return CCRC16( dp, dp+1 ).crc(); }
+    inline static bool      m_scanned     = false;
+    inline static bool      m_valid       = false;
+    inline static int       m_newest      = -1;             // slot of the newest record in the log, -1 if none
+    inline static uint32_t  m_sequence    = 0;              // its sequence number
+    inline static t         m_current;                      // what we last read or saved
 
-    inline static tWithCRC const *  m_flashPtr    = nullptr;          // Points to area in flash holding array of tWithCRC
-    inline static bool              m_valid       = false;
- 
     configBase( const char *name );
-    void        save( t const * );
+    bool        save( t const * );
     inline bool valid() const           { return m_valid == true; }
+    const t&    data() const            { return m_current; }
     const char * name() const           { return m_name; }
     void        zap();
 };
 
-template< class t, uint32_t top >
-configBase<t,top>::configBase( const char *name ) : m_name( name ) {
-    if( m_flashPtr == nullptr ) {
-        for( m_flashPtr = baseAddress() + numConfigInFlash - 1;  m_flashPtr >= baseAddress(); --m_flashPtr ) {
-            if( calcCRC( &m_flashPtr->m_data ) == m_flashPtr->m_crc ) {
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+configBase<t,top,sectors,legacyTop>::configBase( const char *name ) : m_name( name ) {
+    if( m_scanned )
+        return;
+    m_scanned = true;
+
+    int newestSector = -1;
+    for( int sector = 0; sector < sectors; ++sector ) {
+        const int first = sector * recordsPerSector;
+        if( !blank( first ) && recordAt( first )->valid() &&
+            (newestSector < 0 || int32_t( recordAt( first )->m_sequence - m_sequence ) > 0) ) {
+            newestSector = sector;
+            m_sequence = recordAt( first )->m_sequence;
+        }
+    }
+
+    if( newestSector >= 0 ) {
+        int written = newestSector * recordsPerSector;
+        int end = written + recordsPerSector;           // first blank slot, or the end of the sector
+        while( end - written > 1 ) {
+            const int mid = (written + end) / 2;
+            if( blank( mid ) )
+                end = mid;
+            else
+                written = mid;
+        }
+
+        //
+        // The last record written might have been cut short.  The sector's first record is good, so this stops
+        //
+        for( m_newest = written; !recordAt( m_newest )->valid(); --m_newest )
+            ;
+        m_sequence = recordAt( m_newest )->m_sequence;
+    }
+
+    if( m_newest >= 0 ) {
+        m_current = recordAt( m_newest )->m_data;
+        m_valid = true;
+    } else if( legacyTop != 0 ) {
+        auto const base = (legacy_t const *)((char *)(XIP_BASE) + legacyTop - FLASH_SECTOR_SIZE);
+        for( auto lp = base + FLASH_SECTOR_SIZE / sizeof(legacy_t) - 1; lp >= base; --lp ) {
+            if( CCRC16( &lp->m_data, &lp->m_data + 1 ).crc() == lp->m_crc ) {
+                m_current = lp->m_data;
                 m_valid = true;
                 break;
             }
         }
-        if( !m_valid )
-            m_flashPtr = baseAddress();
     }
 }
 
-template< class t, uint32_t top >
-void configBase<t,top>::save( t const * const tp ) {
-    const auto newCRC = calcCRC(tp);
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+bool configBase<t,top,sectors,legacyTop>::sectorErased( int sector ) {
+    auto const p = (uint32_t const *)((char *)(XIP_BASE) + offsetInFlash + sector * FLASH_SECTOR_SIZE);
+    for( uint i = 0; i < FLASH_SECTOR_SIZE / sizeof(*p); ++i )
+        if( p[i] != 0xFFFFFFFF )
+            return false;
+    return true;
+}
 
-    if( newCRC == calcCRC( &m_flashPtr->m_data ) )
-        return;
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+void configBase<t,top,sectors,legacyTop>::eraseSector( int sector ) {
+    CLOCKOUT_OTHER_CORE otherCoreParked;
+    CINTERRUPTS_OFF intsOff;
+    flash_range_erase( offsetInFlash + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE );
+}
 
-    printf("*******\nCURRENT %s AT SLOT %u of %u at %p: ", name(), m_flashPtr - baseAddress(), numConfigInFlash, m_flashPtr );
-    m_flashPtr->m_data.print();
-    printf("\n");
+//
+// Program the one page holding 'slot'.  Everything but 'r' is 0xFF, so the rest of the page is untouched
+//
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+bool configBase<t,top,sectors,legacyTop>::program( int slot, const record_t& r ) {
+    uint8_t page[ FLASH_PAGE_SIZE ];
+    memset( page, 0xFF, sizeof(page) );
+    memcpy( &page[ (slot % recordsPerPage) * sizeof(r) ], &r, sizeof(r) );
+    {
+        CLOCKOUT_OTHER_CORE otherCoreParked;
+        CINTERRUPTS_OFF intsOff;
+        flash_range_program( offsetInFlash + (slot / recordsPerPage) * FLASH_PAGE_SIZE, page, sizeof(page) );
+    }
+    return memcmp( recordAt( slot ), &r, sizeof(r) ) == 0;
+}
 
-    tWithCRC emptyData;
-    bool foundSlot = false;
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+bool configBase<t,top,sectors,legacyTop>::save( t const * const tp ) {
+    if( m_valid && memcmp( &m_current, tp, sizeof(t) ) == 0 )
+        return true;
+
+    printf("*******\nCURRENT %s AT SLOT %d of %d, sequence %u: ", name(), m_newest, numConfigInFlash, m_sequence );
+    m_current.print();
+    printf("\n");
 
-    for( m_flashPtr = baseAddress(); m_flashPtr < baseAddress() + numConfigInFlash; ++m_flashPtr )
-        if( m_flashPtr->empty() ) {
-            foundSlot = true;
+    //
+    // Find the next free slot after the newest record.  Slots spoiled by an interrupted save are skipped, and
+    //   starting a sector means erasing whatever old records are in it
+    //
+    int slot = m_newest + 1;
+    for( ;; ++slot ) {
+        slot %= numConfigInFlash;
+        if( slot % recordsPerSector == 0 ) {
+            if( !sectorErased( slot / recordsPerSector ) )
+                eraseSector( slot / recordsPerSector );
             break;
         }
-    uint8_t newImage[ sectorsInFlash * FLASH_SECTOR_SIZE ];
-
-    if( !foundSlot ) {
-        m_flashPtr = baseAddress();
-        memset( newImage, 0xFF, sizeof(newImage) );
-    } else {
-        memcpy( newImage, baseAddress(), sizeof( newImage ) );
+        if( recordAt( slot )->empty() )
+            break;
     }
 
-    printf("%u bytes reserved at %p in flash for %s, each entry is %u bytes\n", sizeof(newImage), baseAddress(), name(), sizeof(emptyData) );
-
-    memcpy( &emptyData.m_data, tp, sizeof( emptyData.m_data ) );
-    emptyData.m_crc = newCRC;
-    memcpy( &newImage[ (m_flashPtr - baseAddress()) * sizeof(emptyData) ], &emptyData, sizeof(emptyData) );
+    record_t r;
+    r.m_sequence = (m_sequence + 1 == BLANK) ? 0 : m_sequence + 1;
+    memcpy( (void *)&r.m_data, tp, sizeof( r.m_data ) );
+    r.m_crc = r.calcCRC();
 
-    {
-        CINTERRUPTS_OFF intsOff;
-        if( !foundSlot )
-            zap();
-        flash_range_program( offsetInFlash, newImage, sizeof(newImage) );
+    if( !program( slot, r ) ) {
+        printf("%s: SLOT %d DIDN'T PROGRAM\n", name(), slot );
+        return false;
     }
 
-    printf("NEW %s AT SLOT %u at %p: ", name(), m_flashPtr - baseAddress(), m_flashPtr ); m_flashPtr->m_data.print(); printf("\n\n");
+    m_newest = slot;
+    m_sequence = r.m_sequence;
+    m_current = *tp;
+    m_valid = true;
+
+    printf("NEW %s AT SLOT %d at %p: ", name(), slot, recordAt( slot ) ); m_current.print(); printf("\n\n");
+    return true;
 }
 
 //
-// Erase the entire configuration area
+// Erase the entire log, and the old format sector so it isn't read again
 //
-template< class t, uint32_t top >
-void configBase<t,top>::zap() {
-    CINTERRUPTS_OFF intsOff;
-    flash_range_erase( offsetInFlash, sectorsInFlash * FLASH_SECTOR_SIZE );
-    m_flashPtr = baseAddress();
+template< class t, uint32_t top, int sectors, uint32_t legacyTop >
+void configBase<t,top,sectors,legacyTop>::zap() {
+    {
+        CLOCKOUT_OTHER_CORE otherCoreParked;
+        CINTERRUPTS_OFF intsOff;
+        flash_range_erase( offsetInFlash, sectors * FLASH_SECTOR_SIZE );
+        if( legacyTop != 0 )
+            flash_range_erase( legacyTop - FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE );
+    }
+    m_newest = -1;
+    m_sequence = 0;
+    m_valid = false;
 }
 
 
 //
-// Data in flash is split between two regions...one that changes often and one that doesn't
+// Data in flash is split between regions...one that changes often and ones that don't.  The top three sectors
+//   are where each lived before the data was logged; they are only read, to carry settings over
 //
+static constexpr uint32_t   LEGACY_TOP      = PICO_FLASH_SIZE_BYTES;
+static constexpr uint32_t   CONSTANT_TOP    = LEGACY_TOP - 3*FLASH_SECTOR_SIZE;
+static constexpr uint32_t   MOTION_TOP      = CONSTANT_TOP - 2*FLASH_SECTOR_SIZE;
+static constexpr uint32_t   CHANGING_TOP    = MOTION_TOP - 2*FLASH_SECTOR_SIZE;
+
 struct _constantData {
     struct _d {
         CNVState::gaugeCal_t    gaugeCal;       // gauge 0%, 25%, 50%, 75%, and 100% duty cycle times
@@ -133,7 +256,7 @@ struct _constantData {
         void                    print() const   { printf("PWM:"); for( auto val : gaugeCal ) printf(" %.2f%%", val ); }
     };
 
-    configBase< _d, PICO_FLASH_SIZE_BYTES > m_base;
+    configBase< _d, CONSTANT_TOP, 2, LEGACY_TOP > m_base;
     _constantData() : m_base( "CONSTANT_DATA" ) {}
 };
 
@@ -151,10 +274,24 @@ struct _changingData {
 
     };
 
-    configBase< _d, PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE > m_base;
+    configBase< _d, CHANGING_TOP, NV_FLASH_RING_SECTORS, LEGACY_TOP - FLASH_SECTOR_SIZE > m_base;
     _changingData() : m_base( "CHANGING_DATA" ) {}
 };
 
+//
+// The actuator motion model changes only when it is relearned
+//
+struct _motionData {
+    struct _d {
+        CNVState::motion_t      motion;
+        _d()                                    { memset( (void *)this, 0xFF, sizeof(*this) ); }
+        void                    print() const   { motion.print(); }
+    };
+
+    configBase< _d, MOTION_TOP, 2 > m_base;
+    _motionData() : m_base( "MOTION_DATA" ) {}
+};
+
 static _constantData* constData() {
     static _constantData d;
     return &d;
@@ -165,43 +302,59 @@ static _changingData * changingData() {
     return &d;
 }
 
+static _motionData * motionData() {
+    static _motionData d;
+    return &d;
+}
+
 
 CNVFlash::CNVFlash() : CNVState( "FLASH" ) {
     if( _constantData * const constd = constData(); constd->m_base.valid() == false ||
-        CGauge::isValidCalibration( constd->m_base.m_flashPtr->m_data.gaugeCal ) == false  ) {
+        CGauge::isValidCalibration( constd->m_base.data().gaugeCal ) == false  ) {
         super::gaugeCal().setDefault();
     } else {
-        super::gaugeCal().init( constd->m_base.m_flashPtr->m_data.gaugeCal ).setWasValid(true);
+        super::gaugeCal().init( constd->m_base.data().gaugeCal ).setWasValid(true);
     }
 
     if( _changingData * const changd = changingData(); changd->m_base.valid() == false ) {
         super::actuatorPercent().setDefault();
         super::reason().setDefault();
     } else {
-        super::actuatorPercent().init( changd->m_base.m_flashPtr->m_data.percent()  ).setWasValid(true);
-        super::reason().init( static_cast< super::reason_t >( changd->m_base.m_flashPtr->m_data.reason ) ).setWasValid(true);
+        super::actuatorPercent().init( changd->m_base.data().percent()  ).setWasValid(true);
+        super::reason().init( static_cast< super::reason_t >( changd->m_base.data().reason ) ).setWasValid(true);
+    }
+
+    if( _motionData * const motiond = motionData(); motiond->m_base.valid() == false ||
+        CActuator::isValidMotion( motiond->m_base.data().motion ) == false ) {
+        super::motion().setDefault();
+    } else {
+        super::motion().init( motiond->m_base.data().motion ).setWasValid(true);
     }
 }
 
 //
-// Unsafe if other cores are executing!
+// The other core is parked in RAM while the flash is written (see CLOCKOUT_OTHER_CORE)
 //
-bool CNVFlash::commit() {
-    if( super::actuatorPercent().changed() || super::reason().changed() ) {
+bool CNVFlash::write( const values_t& values, uint8_t& changed ) {
+    if( changed & (ACTUATOR_PERCENT | REASON) ) {
         _changingData::_d changd;
-        changd.setPercent( super::reason().get(), super::actuatorPercent().get() );
-        changingData()->m_base.save( &changd );
-
-        super::actuatorPercent().clearChanged();
-        super::reason().clearChanged();
+        changd.setPercent( values.reason, values.actuatorPercent );
+        if( changingData()->m_base.save( &changd ) )
+            changed &= ~(ACTUATOR_PERCENT | REASON);
     }
 
-    if( super::gaugeCal().changed() ) {
+    if( changed & GAUGE_CAL ) {
         _constantData::_d constd;
-        constd.gaugeCal = gaugeCal().get();
-        constData()->m_base.save( &constd );
+        constd.gaugeCal = values.gaugeCal;
+        if( constData()->m_base.save( &constd ) )
+            changed &= ~GAUGE_CAL;
+    }
 
-        super::gaugeCal().clearChanged();
+    if( changed & MOTION ) {
+        _motionData::_d motiond;
+        motiond.motion = values.motion;
+        if( motionData()->m_base.save( &motiond ) )
+            changed &= ~MOTION;
     }
     return true;
 }
@@ -212,4 +365,5 @@ bool CNVFlash::commit() {
 void CNVFlash::zap() {
     constData()->m_base.zap();
     changingData()->m_base.zap();
+    motionData()->m_base.zap();
 }
@@ -7,7 +7,7 @@
 
 int CPowerFail::m_powerFailCount;
 
-CPowerFail::CPowerFail() : m_gpio( BoardPin::POWER_FAIL, true ) {
+CPowerFail::CPowerFail() : m_gpio( BoardPin::POWER_FAIL, true ), m_myEdge( m_gpio ) {
     //
     // Can we do power fail detection?
     //
@@ -17,10 +17,10 @@ CPowerFail::CPowerFail() : m_gpio( BoardPin::POWER_FAIL, true ) {
     //
     // Enable interrupts for edge low and edge high
     //
-    gpio_set_irq_enabled_with_callback( m_gpio.pin(), GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true, onInterrupt );
+    m_myEdge.enableEdges( GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE );
 }
 
-void CPowerFail::onInterrupt( uint gpio, uint32_t events ) {
+void CPowerFail::onInterrupt( uint32_t events ) {
     if( events & GPIO_IRQ_EDGE_FALL ) {
         //
         // GPIO just went from high to low
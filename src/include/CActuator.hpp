@@ -1,10 +1,33 @@
 class CActuator {
+public:
+	//
+	// How the actuator moves.  The full stroke takes a different time in each direction (more so under
+	//  load), the tab takes a while to get going once the motor starts, and it keeps going a little after
+	//  the motor stops.  Positions are kept in extend time, so retract travel is scaled to it
+	//
+	struct motion_t {
+		int32_t		extendUs;			// fully retracted to fully extended
+		int32_t		retractUs;			// fully extended to fully retracted
+		int32_t		startLagUs;			// motor on until the tab starts moving
+		int32_t		stopLagUs;			// motor off until the tab stops
+
+		bool operator==( const motion_t& rhs ) const	{ return extendUs == rhs.extendUs && retractUs == rhs.retractUs &&
+																startLagUs == rhs.startLagUs && stopLagUs == rhs.stopLagUs; }
+		bool operator!=( const motion_t& rhs ) const	{ return !(*this == rhs); }
+		void print() const		{ printf( "extend %.3f S, retract %.3f S, start lag %.1f mS, stop lag %.1f mS",
+											extendUs / 1e6f, retractUs / 1e6f, startLagUs / 1e3f, stopLagUs / 1e3f ); }
+	};
+	static bool		isValidMotion( const motion_t& m );
+	static int		maxStrokeUs()						{ return ACTUATOR_FULL_TRANSIT_MS * 1000 * 3; }	// longest isValidMotion() takes
+
+private:
 	CGPIO_OUT	m_MOTOR_ENABLE;
 	CGPIO_OUT	m_LPWM;
 	CGPIO_OUT	m_RPWM;
+	CPWM		m_leftPWM;				// drives m_LPWM, retracts
+	CPWM		m_rightPWM;				// drives m_RPWM, extends
 
-	const int m_fullTransitMs;			// designed actuator full retract time
-	const int m_fullTransitMsToBeSure;	// m_fullTransitMs plus some more time just to make sure
+	motion_t	m_motion;
 
 	class runTime_t {
 		absolute_time_t		m_value;
@@ -22,17 +45,66 @@ class CActuator {
 
 		void clear()		{ m_value = nil_time; }
 		void setNow()		{ m_value = get_absolute_time(); }
-		int  ms() const		{ return m_value != nil_time ? int(absolute_time_diff_us( m_value, get_absolute_time() ) / 1000) : 0; }
+		void set( absolute_time_t t )	{ m_value = t; }
+		absolute_time_t when() const	{ return m_value; }
+		int  us() const		{ return m_value != nil_time ? int(absolute_time_diff_us( m_value, get_absolute_time() )) : 0; }
+		int  ms() const		{ return us() / 1000; }
 	} m_startTime, m_lastStopTime;
 
 	bool		m_moved;
-	int8_t		m_currentDirection;				// 0 -> not moving, 1 extending, -1 retracting
-	int			m_currentPositionMs = 0;		// current position in ms running time from fully retracted
+	volatile int8_t	m_currentDirection;			// 0 -> not moving, 1 extending, -1 retracting
+	int			m_currentPositionUs = 0;		// current position in us extend time from fully retracted
+	absolute_time_t	m_motorStoppedAt = nil_time;	// when stopMotion() last dropped the H-bridge inputs
+
+	//
+	// The H-bridge is ramped by a timer rather than switched.  m_wantDirection is where we're headed,
+	//  m_driveDirection is which input is being driven right now and m_duty is how hard.  A direction
+	//  change ramps down to zero before the other input is ramped up
+	//
+	volatile int8_t	m_wantDirection = 0;
+	int8_t		m_driveDirection = 0;
+	float		m_duty = 0;
+	int			m_stopAfterUs = -1;				// timed stop to arm once the motor really starts
+
+	//
+	// While core 0 writes flash we're parked in RAM with interrupts off, and parkedWatch() stands in for the stop
+	//  alarm.  cutMotor() records when it cut the motor so halt() can account for it when things catch up
+	//
+	volatile bool		m_stopArmed = false;
+	volatile uint32_t	m_stopDeadline = 0;			// low 32 bits of the stop alarm time
+	volatile bool		m_cut = false;
+	absolute_time_t		m_cutAt = nil_time;
+	static void	parkedWatch( void *context );
+
+	struct CRampTick : public CGlobalTimer::COnTick {
+		CActuator&	m_actuator;
+		void onTick() override							{ m_actuator.rampStep(); }
+		CRampTick( CActuator& a ) : COnTick( MOTOR_RAMP_STEP_MS ), m_actuator(a)	{}
+	} m_rampTick;
 
-	void		startExtendMotion();
-	void		startRetractMotion();
+	void		startMotion( int8_t direction );
+	void		startExtendMotion()						{ startMotion( 1 ); }
+	void		startRetractMotion()					{ startMotion( -1 ); }
 	void		stopMotion();
-	
+	void		rampStep();
+	bool		halt();
+	void		onMoveDeadline();
+	void		armStop();
+	int			travelUs( int8_t direction, int onUs, bool stopped ) const;
+	int			onTimeUs( int8_t direction, int travel ) const;
+	int			fullRetractUsToBeSure() const		{ return onTimeUs( -1, (11 * m_motion.extendUs) / 10 ); }
+
+	//
+	// A hardware alarm of our own stops the motor when a timed move (moveTo() or startFullRetract()) should
+	//  be done, so the stop isn't queued behind other timer callbacks
+	//
+	struct CStopAlarm : public CHardwareAlarm {
+		CActuator&	m_actuator;
+		void onAlarm() override							{ m_actuator.onMoveDeadline(); }
+		CStopAlarm( CActuator& a ) : m_actuator(a)		{}
+	} m_stopAlarm;
+
+
 	class CGaugeUpdater {
 		CMessage::Type		m_msgType = CMessage::Type::GAUGE_UPDATE;
 
@@ -60,7 +132,7 @@ class CActuator {
 	} m_gaugeUpdater;
 
 public:
-	CActuator( int fullTransitMs );
+	CActuator( const motion_t& motion );
 	~CActuator()	{}
     bool            moved() const                   	{ return m_moved; }     // have we moved the actuator?
     void            setMoved( bool state );
@@ -68,11 +140,32 @@ public:
 	void			extend( bool updateGauge = true );
 	void			retract( bool updateGauge = true );
 	void			startFullRetract( bool updateGauge = true);
-	int				targetRullRetractRunTime() const	{ return m_fullTransitMsToBeSure; }
+
+	//
+	// Drive the actuator to 'percent' and stop it there from a timer.  An ACTUATOR_DONE message is posted when the
+	//  motor stops.  Returns false if we're already close enough and nothing moved (no message is posted)
+	//
+	bool			moveTo( float percent, bool updateGauge = true );
+
+	//
+	// Stop the motor 'us' after it starts, as moveTo() does; a limit on an extend() or retract() that waits on
+	//  the owner.  An ACTUATOR_DONE message is posted if it's what stops the motor
+	//
+	void			stopAfter( int us );
+	void			waitForStop() const					{ while( active() ) __wfi(); }
+	int				targetRullRetractRunTime() const	{ return fullRetractUsToBeSure() / 1000; }
 	void			stop();
 	bool			active() const						{ return m_currentDirection != 0; }
 	int				activeTime() const					{ return m_startTime.ms(); }
-	int				fullTransitMs() const				{ return m_fullTransitMs; }
+	int				fullTransitMs() const				{ return m_motion.extendUs / 1000; }
+	const motion_t&	motion() const						{ return m_motion; }
+	void			setMotion( const motion_t& m );		// new model, keeping the current percent
+
+	//
+	// Drop the H-bridge inputs right now, from RAM.  For use while the other core has flash tied up; halt() still
+	//  has to be called once the interrupts are back to account for the move
+	//
+	void			cutMotor();
 	int				msPerGaugeTick() const				{ return m_gaugeUpdater.msPerTick(); }
 	int				secondsSinceLastStop() const;
 	float		    percent() const;
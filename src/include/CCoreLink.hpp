@@ -0,0 +1,85 @@
+#pragma once
+
+//
+// With TAPS_DUAL_CORE, core 1 runs the trim (the actuator, gauge, switches and all of their interrupts) and core 0
+//   runs the USB console and the nonvolatile storage.  The cores only talk through the FIFOs here, so nothing slow
+//   on core 0 (USB, FRAM, flash) can hold up a motor stop on core 1
+//
+
+//
+// Single producer, single consumer FIFO between the cores.  The producer only ever writes m_head and the consumer
+//   only ever writes m_tail, so no lock is needed even without atomic instructions.  A push wakes the other core
+//   if it is sitting in __wfe()
+//
+template< class T, uint N >
+class CCoreFIFO : private NonCopyable {
+    static_assert( (N & (N-1)) == 0, "CCoreFIFO size must be a power of 2" );
+
+    T                   m_items[ N ];
+    volatile uint32_t   m_head = 0;             // next slot to fill, producer only
+    volatile uint32_t   m_tail = 0;             // next slot to empty, consumer only
+    uint32_t            m_dropped = 0;          // pushes refused because we were full, producer only
+
+public:
+    CCoreFIFO() {}
+
+    bool push( const T& item ) {
+        const uint32_t head = m_head;
+        if( head - m_tail >= N ) {
+            ++m_dropped;
+            return false;
+        }
+        m_items[ head & (N-1) ] = item;
+        __dmb();                                // the item is visible before the consumer can see it's there
+        m_head = head + 1;
+        __sev();
+        return true;
+    }
+
+    bool pop( T& item ) {
+        const uint32_t tail = m_tail;
+        if( tail == m_head )
+            return false;
+        __dmb();
+        item = m_items[ tail & (N-1) ];
+        __dmb();                                // done with the slot before the producer can reuse it
+        m_tail = tail + 1;
+        return true;
+    }
+
+    bool        empty() const                   { return m_head == m_tail; }
+    uint32_t    dropped() const                 { return m_dropped; }
+};
+
+//
+// Console output.  Once installed, printf() on either core just copies into a ring that core 0 drains to USB from
+//   its loop (and while it waits for console input), so a slow or absent USB host never blocks core 1.  Output that
+//   doesn't fit is dropped and counted
+//
+class CConsoleLog {
+public:
+    static void install();                      // core 0, after stdio_init_all()
+    static void drain();                        // core 0 only
+};
+
+//
+// The other core can't run from flash while this one erases or programs it.  For the life of the outermost one of
+//   these, the other core (if it called victimInit()) is parked in a RAM interrupt handler with its interrupts off,
+//   since all of its usual handlers are in flash.  Anything that can't wait out an erase registers a watch, which the
+//   parked core calls over and over.  A watch must be __not_in_flash_func and only touch RAM and hardware registers;
+//   the real handlers catch up from their pending interrupts once the core is let go
+//
+class CLOCKOUT_OTHER_CORE {
+public:
+    typedef void (*watch_t)( void *context );
+
+    static void victimInit();                               // on the core that is to be parked
+    static bool addWatch( watch_t watch, void *context );   // ditto; false if there's no room
+
+    CLOCKOUT_OTHER_CORE();
+    ~CLOCKOUT_OTHER_CORE();
+
+private:
+    inline static int   m_depth = 0;
+    const bool          m_parked;
+};
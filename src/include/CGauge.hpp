@@ -5,24 +5,66 @@ class CGauge {
 	CGPIO_OUT					m_gaugeEnablePin;
 	CGPIO_OUT					m_notGaugeEnablePin;
     CPWM                        m_gaugePWM;
-	std::array< float, 401 >	m_dutyCycleMap;
 	float						m_percent;
 
-	void fillBetween( int low, float dutyLow, int high, float dutyHigh);
+	//
+	// Moves the duty cycle toward m_target a step per tick, from the timer interrupt, and then on to m_next
+	//   if there is one.  Posts GAUGE_SLEW_DONE once it gets to the end
+	//
+	struct CSlew : public CGlobalTimer::COnTick {
+		CGauge&		m_gauge;
+		float		m_current;
+		float		m_target;
+		float		m_next;				// where to go after m_target; NAN for nowhere
+		bool		m_ease;				// slow down coming into m_target?
+
+		CSlew( CGauge& gauge );
+		void onTick() override;
+	} m_slew;
+
+public:
+	typedef std::array< float, 5 >		calType_t;
+
+private:
+	//
+	// The gauge transfer function is a monotone cubic (PCHIP) through the calibration knots.  Each 25% segment is
+	//   a + t*(b + t*(c + t*d)) for t in [0,1), all in Q16 so an update is integer multiplies
+	//
+	static constexpr int	Q16_SHIFT = 16;
+	static constexpr int32_t	Q16_ONE = 1 << Q16_SHIFT;
+
+	struct segment_t {
+		int32_t	a, b, c, d;
+	};
+
+	calType_t								m_cal;
+	std::array< segment_t, std::tuple_size< calType_t >::value - 1 >	m_spline;
+
     void smooth();
     float mapGaugeToDutyCycle( float gaugePercent ) const;
 
 public:
-	typedef std::array< float, 5 >		calType_t;
 
 	CGauge( const calType_t &cal, uint hz = 10000 );
 	~CGauge() {}
 	CGauge&	set( float percent );
-	CGauge&	setSlow( float percent );
 	float	get() const						{ return m_percent; }
 
+	//
+	// Start the needle moving to 'percent' and return.  It gets there at no more than GAUGE_SLEW_DUTY_PER_SEC,
+	//   easing in at the end if 'ease'.  set() and setCurrentDutyCycle() stop it where it is
+	//
+	CGauge&	setSlow( float percent, bool ease = false );
+
+	//
+	// Slew to 'percent' once the slew under way is done, or right away if there isn't one
+	//
+	CGauge&	thenSlow( float percent );
+
+	bool	slewing() const					{ return m_slew.enabled(); }
+
 	CGauge&	setCurrentDutyCycle( float dutyCycle );
-	CGauge&	setCurrentDutyCycleSlow( float dutyCycle );
+	CGauge&	setCurrentDutyCycleSlow( float dutyCycle, bool ease = false );
 	float	currentDutyCycle() const;
 
 	static bool isValidCalibration( const calType_t &settings );
@@ -37,8 +79,8 @@ public:
 
 //	CGauge& disable()						{ m_gaugePWM.disable(); return *this; }		// no coming back from this!
 
-	auto getLowPercent() const				{ return m_dutyCycleMap[0]; }
-	auto getHighPercent() const				{ return m_dutyCycleMap[ m_dutyCycleMap.size() - 1 ]; }
+	auto getLowPercent() const				{ return m_cal[0]; }
+	auto getHighPercent() const				{ return m_cal[ m_cal.size() - 1 ]; }
 
 	CPWM&	pwm()							{ return m_gaugePWM; }
 };
\ No newline at end of file
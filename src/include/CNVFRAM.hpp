@@ -1,3 +1,4 @@
+#include    <cstddef>
 #include    "CNVState.hpp"
 #include    "CRC.hpp"
 
@@ -10,20 +11,66 @@ class CNVFRAM : public CNVState {
     typedef CNVState super;
 
     mutable CI2C    m_i2c;
+    uint32_t        m_sequence = 0;         // of the newest record
+    int             m_slot = -1;            // where the newest record is, or -1 if there isn't one
+    int             m_writingSlot = -1;     // where the write under way is going, or -1 if there isn't one
+    bool            m_written = false;      // did the last write make it?
 
-    bool    get( uint eepromAddress, void *buf, uint numberOfBytes ) const;
+    bool    get( uint eepromAddress, void *buf, uint numberOfBytes );
     bool    set( uint eepromAddress, const void *buf, uint numberOfBytes );
 
+    void    finishWrite();
+    void    settleWrite();
+
+    void    readLegacy();
+
 public:
     CNVFRAM( uint8_t sevenBitAddr, BoardPin::type_t sdaPin );
-    bool commit() override;
+    bool write( const values_t& values, uint8_t& changed ) override;
+    bool writeDone( uint8_t& changed ) override;
+    bool healthy() const override           { return m_i2c.health() > 0; }
     void zap() override;
-    bool unlimitedUpdates() const override  { return true; }
+    bool unlimitedUpdates() const override  { return !failedOver(); }
+    bool writesInBackground() const override    { return !failedOver(); }
 
     uint size() const;
 
     //
-    // Here are the addresses of the items we store in FRAM
+    // Everything we store, written and read in one I2C transaction.  The CRC covers all that comes before it, so
+    //   a write cut short by a power failure is seen as such.  Fields are laid out on their natural alignment,
+    //   with the spare bytes spelled out, since the M0+ can't load from unaligned addresses.  Bump RECORD_VERSION
+    //   whenever this changes
+    //
+    // Records alternate between two slots, each write going over the older one, so a write cut short only ever
+    //   costs the record being written.  The valid one with the higher sequence number is the newest
+    //
+    static constexpr uint8_t    RECORD_VERSION      = 2;
+
+    struct record_t {
+        uint8_t                     version;
+        super::reason_t             reason;
+        uint8_t                     spare[2];
+        uint32_t                    sequence;
+        super::actuatorPercent_t    percent;
+        super::gaugeCal_t           gaugeCal;
+        super::motion_t             motion;
+        CCRC16::type_t              crc;
+
+        CCRC16::type_t  calcCRC() const             { return CCRC16( this, &crc ).crc(); }
+        bool            valid() const               { return version == RECORD_VERSION && crc == calcCRC(); }
+    };
+    static constexpr uint   RECORD_BYTES            = offsetof( record_t, crc ) + sizeof( CCRC16::type_t );
+    static_assert( offsetof( record_t, crc ) == 8 + sizeof( super::actuatorPercent_t ) + sizeof( super::gaugeCal_t ) +
+                   sizeof( super::motion_t ), "record_t has hidden padding" );
+
+    static constexpr uint   RECORD_SLOT_BYTES       = 64;
+    static constexpr uint   ADDR_RECORD             = 64;           // two slots, clear of the old layout below
+    static_assert( RECORD_BYTES <= RECORD_SLOT_BYTES, "record_t doesn't fit its slot" );
+
+    static constexpr uint   recordAddr( int slot )  { return ADDR_RECORD + slot * RECORD_SLOT_BYTES; }
+
+    //
+    // The addresses of the items as we stored them before record_t.  We only read these, to carry the settings over
     //
     static constexpr uint   ADDR_GAUGE_CAL          = 0;
     static constexpr uint   ADDR_GAUGE_CAL_CRC      = ADDR_GAUGE_CAL + sizeof( super::gaugeCal_t );
@@ -33,4 +80,11 @@ public:
     static constexpr uint   ADDR_ACTUATOR_CRC       = ADDR_ACTUATOR_PERCENT + sizeof( super::actuatorPercent_t );
 
     bool doCommand( int cmd ) override;
+
+private:
+    //
+    // The record being written in the background and its address; CI2C sends them from here
+    //
+    uint8_t         m_writeAddr[2];
+    record_t        m_writeRecord;
 };
\ No newline at end of file
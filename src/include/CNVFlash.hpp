@@ -9,7 +9,7 @@ class CNVFlash : public CNVState {
     typedef CNVState super;
 public:
     CNVFlash();
-    bool commit() override;
+    bool write( const values_t& values, uint8_t& changed ) override;
     void zap() override;
 };
 
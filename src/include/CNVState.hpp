@@ -1,5 +1,7 @@
 #pragma once
 
+#include "pico/critical_section.h"
+
 //
 // This encapsulates our non-volatile storage for items such as actuator position
 //   and gauge calibration.  It might be implemented with different backing store
@@ -32,6 +34,18 @@ public:
     }
     typedef CGauge::calType_t   gaugeCal_t;
     typedef float               actuatorPercent_t;
+    typedef CActuator::motion_t motion_t;
+
+    //
+    // A copy of everything we store, and bits saying which of it needs writing
+    //
+    struct values_t {
+        gaugeCal_t          gaugeCal;
+        actuatorPercent_t   actuatorPercent;
+        reason_t            reason;
+        motion_t            motion;
+    };
+    enum : uint8_t { GAUGE_CAL = 0x01, ACTUATOR_PERCENT = 0x02, REASON = 0x04, MOTION = 0x08, ALL = 0x0F };
 
 private:
     //
@@ -52,7 +66,7 @@ private:
         void            clearChanged()              { m_changed = false; }
         bool            wasValid() const            { return m_wasValid; }
         CValue&         setWasValid( bool b )       { m_wasValid = b; return *this; }
-        void            print() const               { printf("%s (changed %d, wasValid %d): ", m_name, m_changed, m_wasValid ); }
+        void            print( bool queued ) const  { printf("%s (queued %d, wasValid %d): ", m_name, queued, m_wasValid ); }
         virtual CValue& setDefault()                = 0;
     };
 
@@ -79,11 +93,52 @@ private:
         }
     } m_reason;                     // why did we save this actuator position?
 
+    struct __4__: public CValue< motion_t > {
+        __4__() : CValue("Actuator Motion") {}
+        CValue& setDefault() override {
+            motion_t d = { ACTUATOR_FULL_TRANSIT_MS * 1000, ACTUATOR_FULL_TRANSIT_MS * 1000, 0, ACTUATOR_RUN_ON_MS * 1000 };
+            return init( d );
+        }
+    } m_motion;                     // actuator stroke times and lags, learned during configuration
+
+    //
+    // The background writer.  commitAsync() copies the members into m_pending and service() takes m_pending to
+    //   write it, so the members, m_pending and the copy being written are three separate buffers and the writer
+    //   can run on the other core.  Updates queued before the writer gets to them coalesce:  only the newest values
+    //   are written.  m_pending is also what the other core reads (snapshot()), as the members aren't its to read
+    //
+    mutable critical_section_t  m_lock;
+    values_t            m_pending;
+    uint8_t             m_pendingChanged = 0;   // under m_lock
+    bool                m_zapQueued = false;    // under m_lock
+    uint8_t             m_unwritten = 0;        // writer only; what the last write failed to save
+    uint8_t             m_writingChanged = 0;   // writer only; what the write under way is saving
+    bool                m_writing = false;      // writer only; is write() carrying on in the background?
+    values_t            m_writingValues;        // writer only; what the write under way is saving
+
+    CNVState            *m_failover = nullptr;  // where we save once our own storage has gone bad
+    volatile bool       m_failedOver = false;
+
+    void                queue( uint8_t changed );
+
 protected:
     //
     // Load our members from the stored state
     //
-    CNVState( const char * const name ) : m_name( name ) {}
+    CNVState( const char * const name ) : m_name( name ) { critical_section_init( &m_lock ); }
+
+    //
+    // Save 'values' to nonvolatile storage.  'changed' says which of them need it; clear the bits of those saved.
+    //   Returning false says the write carries on in the background, and service() calls writeDone() until it
+    //   returns true, clearing the bits then
+    //
+    virtual bool    write( const values_t& values, uint8_t& changed ) = 0;
+    virtual bool    writeDone( uint8_t& changed )   { (void)changed; return true; }
+
+    //
+    // Is our storage working well enough to keep using?
+    //
+    virtual bool    healthy() const                 { return true; }
 
 public:
     //
@@ -97,9 +152,47 @@ public:
     virtual void    zap() = 0;
 
     //
-    // Save our members to nonvolatile storage
+    // Queue our changed members to be saved to nonvolatile storage, without waiting for it
     //
-    virtual bool    commit() = 0;
+    CNVState&       commitAsync();
+
+    //
+    // Copy the members to where snapshot() reads them, as commitAsync() does.  Once, after loading them, before
+    //   whoever owns them starts changing them
+    //
+    CNVState&       publish()                       { queue( 0 ); return *this; }
+
+    //
+    // Back to the defaults with nothing queued, and the storage zapped by the next service().  For the owner of
+    //   the members, as commitAsync() is; the console asks it to (NV_ZAP)
+    //
+    CNVState&       zapAsync();
+
+    //
+    // What was last queued (or published), and which of it is still waiting to be written.  Safe from either core
+    //
+    values_t        snapshot( uint8_t& queued ) const;
+
+    //
+    // Whoever owns the storage calls this from its loop.  If anything was queued, write it and return true with
+    //   'ok' saying whether it all got saved.  What didn't is tried again with the next commitAsync().  A write
+    //   that carries on in the background returns false until it's done.  A queued zap goes first, on its own
+    //
+    bool            service( bool& ok );
+
+    //
+    // service() until everything queued is written, waiting on any background write.  For the owner of the storage
+    //   when a save can't wait its turn in the loop (power failure).  Returns false if nothing was queued
+    //
+    bool            flush( bool& ok );
+
+    //
+    // Should our storage go bad, carry on saving everything to 'backup' instead.  If 'backup' already holds
+    //   state, we failed over to it last time round and that state is newer than ours:  take it, save it here
+    //   and clear 'backup' out.  If we can't save it here, we start out failed over
+    //
+    void            failOverTo( CNVState& backup );
+    bool            failedOver() const              { return m_failedOver; }
 
     //
     // Can we update NV storage without any wear-out issues?
@@ -107,7 +200,12 @@ public:
     virtual bool    unlimitedUpdates() const        { return false; }
 
     //
-    // print our members to the console
+    // Does service() return while the storage is being written, rather than waiting for it?
+    //
+    virtual bool    writesInBackground() const      { return false; }
+
+    //
+    // print the snapshot() to the console
     //
     void        print() const;
 
@@ -120,8 +218,12 @@ public:
     auto&       reason()                            { return m_reason; }
     const auto& reason() const                      { return m_reason; }
 
+    auto&       motion()                            { return m_motion; }
+    const auto& motion() const                      { return m_motion; }
+
     CNVState&   setGaugeCal( const gaugeCal_t& c )  { m_gaugeCal.set(c); return *this; }
     CNVState&   setActuatorPercent( actuatorPercent_t p, reason_t r )   { m_actuatorPercent.set(p); m_reason.set(r); return *this; }
+    CNVState&   setMotion( const motion_t& m )      { m_motion.set(m); return *this; }
 
     const char  *name() const                       { return m_name; }
     virtual bool doCommand( int cmd )               { (void)cmd; return false; }
@@ -133,23 +235,170 @@ inline CNVState& CNVState::setDefaults() {
     m_gaugeCal.setDefault();
     m_actuatorPercent.setDefault();
     m_reason.setDefault();
+    m_motion.setDefault();
+    return *this;
+}
+
+inline void CNVState::queue( uint8_t changed ) {
+    critical_section_enter_blocking( &m_lock );
+    m_pending = { m_gaugeCal.get(), m_actuatorPercent.get(), m_reason.get(), m_motion.get() };
+    m_pendingChanged |= changed;
+    critical_section_exit( &m_lock );
+    __sev();                        // in case the writer is waiting in __wfe()
+}
+
+inline CNVState& CNVState::commitAsync() {
+    const uint8_t changed = (m_gaugeCal.changed() ? GAUGE_CAL : 0) | (m_actuatorPercent.changed() ? ACTUATOR_PERCENT : 0) |
+                            (m_reason.changed() ? REASON : 0) | (m_motion.changed() ? MOTION : 0);
+    if( changed ) {
+        queue( changed );
+        m_gaugeCal.clearChanged();
+        m_actuatorPercent.clearChanged();
+        m_reason.clearChanged();
+        m_motion.clearChanged();
+    }
+    return *this;
+}
+
+inline CNVState& CNVState::zapAsync() {
+    setDefaults();
+    m_gaugeCal.setWasValid( false );
+    m_actuatorPercent.setWasValid( false );
+    m_reason.setWasValid( false );
+    m_motion.setWasValid( false );
+
+    critical_section_enter_blocking( &m_lock );
+    m_pending = { m_gaugeCal.get(), m_actuatorPercent.get(), m_reason.get(), m_motion.get() };
+    m_pendingChanged = 0;
+    m_zapQueued = true;
+    critical_section_exit( &m_lock );
+    __sev();
     return *this;
 }
 
+inline CNVState::values_t CNVState::snapshot( uint8_t& queued ) const {
+    critical_section_enter_blocking( &m_lock );
+    const values_t values = m_pending;
+    queued = m_pendingChanged;
+    critical_section_exit( &m_lock );
+    return values;
+}
+
+inline bool CNVState::service( bool& ok ) {
+    CNVState& store = m_failedOver ? *m_failover : *this;
+
+    if( m_writing == false ) {
+        uint8_t     changed = 0;
+
+        critical_section_enter_blocking( &m_lock );
+        const bool zapping = m_zapQueued;
+        m_zapQueued = false;
+        if( m_pendingChanged && !zapping ) {
+            m_writingValues = m_pending;
+            changed = m_pendingChanged;
+            m_pendingChanged = 0;
+        }
+        critical_section_exit( &m_lock );
+
+        if( zapping ) {
+            zap();
+            if( m_failedOver )
+                m_failover->zap();          // or failOverTo() brings it all back next time
+            m_unwritten = 0;
+            ok = true;
+            return true;
+        }
+        if( changed == 0 )
+            return false;
+
+        m_writingChanged = changed | m_unwritten;
+        m_writing = true;
+        if( store.write( m_writingValues, m_writingChanged ) == false )
+            return false;
+    } else if( store.writeDone( m_writingChanged ) == false ) {
+        return false;
+    }
+
+    m_writing = false;
+    m_unwritten = m_writingChanged;
+    ok = (m_unwritten == 0);
+
+    //
+    // Our storage has gone bad.  Everything goes to the backup from here on, starting now
+    //
+    if( !ok && !m_failedOver && m_failover != nullptr && !healthy() ) {
+        printf( "*** %s failing, saving to %s ***\n", m_name, m_failover->name() );
+        m_failedOver = true;
+        critical_section_enter_blocking( &m_lock );
+        if( m_pendingChanged == 0 )
+            m_pending = m_writingValues;
+        m_pendingChanged |= ALL;
+        critical_section_exit( &m_lock );
+    }
+    return true;
+}
+
+inline bool CNVState::flush( bool& ok ) {
+    bool wrote = false;
+    while( m_writing || m_pendingChanged || m_zapQueued ) {
+        if( bool done; service( done ) ) {
+            wrote = true;
+            ok = done;
+        } else if( m_writing ) {
+            __wfe();                // the background write's completion does __sev()
+        }
+    }
+    return wrote;
+}
+
+inline void CNVState::failOverTo( CNVState& backup ) {
+    m_failover = &backup;
+    if( !backup.gaugeCal().wasValid() && !backup.actuatorPercent().wasValid() && !backup.motion().wasValid() )
+        return;
+
+    printf( "Taking what was saved to %s when %s failed\n", backup.name(), m_name );
+    if( backup.gaugeCal().wasValid() )
+        m_gaugeCal.init( backup.gaugeCal().get() ).setWasValid( true );
+    if( backup.actuatorPercent().wasValid() && backup.reason().wasValid() ) {
+        m_actuatorPercent.init( backup.actuatorPercent().get() ).setWasValid( true );
+        m_reason.init( backup.reason().get() ).setWasValid( true );
+    }
+    if( backup.motion().wasValid() )
+        m_motion.init( backup.motion().get() ).setWasValid( true );
+
+    queue( ALL );
+    bool ok = false;
+    while( service( ok ) == false )
+        __wfe();
+
+    if( ok )
+        backup.zap();
+    else
+        m_failedOver = true;
+}
+
 inline void CNVState::print() const {
     printf("\n%s\n", m_name );
+    if( m_failedOver )
+        printf( "*** Failed over to %s ***\n", m_failover->name() );
 
     printf("PWM freq: %d HZ\n", GAUGE_PWM_FREQ );
-    printf("Actuator stroke: %.2f inches, rate: %.2f sec per inch\n", ACTUATOR_STROKE_INCHES, ACTUATOR_SECONDS_PER_INCH );
+    printf("Actuator stroke: %.2f inches, nominal rate: %.2f sec per inch\n", ACTUATOR_STROKE_INCHES, ACTUATOR_SECONDS_PER_INCH );
 
-    auto cal = gaugeCal();
-    cal.print();
-    for( auto val : cal.get() ) printf(" %.2f%%", val );
+    uint8_t queued;
+    const values_t values = snapshot( queued );
+
+    gaugeCal().print( queued & GAUGE_CAL );
+    for( auto val : values.gaugeCal ) printf(" %.2f%%", val );
     printf("\n");
 
-    actuatorPercent().print();
-    printf("%.2f%%\n", actuatorPercent().get() );
+    actuatorPercent().print( queued & ACTUATOR_PERCENT );
+    printf("%.2f%%\n", values.actuatorPercent );
+
+    reason().print( queued & REASON );
+    printf( "%s\n", string(values.reason) );
 
-    reason().print();
-    printf( "%s\n", string(reason().get()) );
+    motion().print( queued & MOTION );
+    values.motion.print();
+    printf( "\n" );
 }
\ No newline at end of file
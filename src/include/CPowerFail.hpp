@@ -2,7 +2,12 @@ class CPowerFail {
     CGPIO_IN    m_gpio;
     static int m_powerFailCount;       // increments on fail, decrements on not fail
 
-    static void onInterrupt( uint gpio, uint32_t events );
+    struct myEdge : public CGPIOEdge {
+        void onEdge( uint32_t events ) override     { CPowerFail::onInterrupt( events ); }
+        myEdge( CGPIO_IN& gpio ) : CGPIOEdge( gpio ) {}
+    } m_myEdge;
+
+    static void onInterrupt( uint32_t events );
 public:
     CPowerFail();
 
@@ -10,6 +15,7 @@ public:
     // Can we do power fail detection?
     //
     bool available() const  { return m_gpio.available(); }
+    const CGPIO_IN& gpio() const        { return m_gpio; }
 
     //
     // TRUE on power failure, FALSE otherwise
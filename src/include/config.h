@@ -17,11 +17,58 @@ const int CONFIG_ABORT_MS = 2000;
 //
 const int CONFIG_INACTIVITY_ABORT_SEC = 60;
 
+//
+// How long does it take the owner to press the configuration button once they see the tab move?
+//   Only the actuator start lag learned during configuration depends on this
+//
+const int OWNER_REACTION_MS = 250;
+
+//
+// How long must the trim switch and configuration pushbutton be quiet after an edge before
+//   we believe the new state?  The trim switch window is most of the trim response time
+//
+const int TRIM_SWITCH_SETTLE_US = 5000;
+const int CONFIG_BUTTON_SETTLE_US = 20000;
+
+//
+// The H-bridge inputs are driven with PWM so the motor can be ramped on and off.  The ramp
+//   times are from stopped to full speed and back; 0 switches the motor hard
+//
+const int MOTOR_PWM_FREQ = 20000;
+const int MOTOR_RAMP_UP_MS = 100;
+const int MOTOR_RAMP_DOWN_MS = 50;
+const int MOTOR_RAMP_STEP_MS = 2;
+
+//
+// Run the trim (actuator, gauge and switches) on core 1 and the USB console and nonvolatile storage
+//   on core 0?  0 runs everything on core 0
+//
+#define TAPS_DUAL_CORE 1
+
+//
+// How many flash sectors does the often saved actuator position rotate through?  More sectors spread
+//   the erases further.  Only used when there's no FRAM
+//
+const int NV_FLASH_RING_SECTORS = 8;
+
+//
+// The fastest I2C clock we try the FRAM at.  FRAM parts run at 1MHz (fast mode plus); if it doesn't answer
+//   there, e.g. with long wires or weak pull ups, we fall back to 400KHz and then 100KHz
+//
+const int FRAM_I2C_HZ = 1000 * 1000;
+
 //
 // What PWM frequency do we use to run the actuator gauge?
 //
 const int GAUGE_PWM_FREQ = 30000;
 
+//
+// How fast does the gauge needle move when it's slewed rather than set?  In PWM duty cycle percent per
+//   second, a step every GAUGE_SLEW_STEP_MS
+//
+constexpr float GAUGE_SLEW_DUTY_PER_SEC = 50;
+const int GAUGE_SLEW_STEP_MS = 20;
+
 // #define TIGE2004_20V 1
 #define TIGE2006_22VE 1
 
@@ -84,3 +131,10 @@ const int GAUGE_PWM_FREQ = 30000;
 #endif
 
 const int ACTUATOR_FULL_TRANSIT_MS = int( ACTUATOR_STROKE_INCHES * ACTUATOR_SECONDS_PER_INCH * 1000 );
+
+//
+// How long does the actuator keep moving after the motor is braked?  Timed moves stop the motor
+//   this much early and every stop credits the position with it.  Measure it on the boat by
+//   bumping the trim and comparing the gauge with the tab; 0 assumes the brake is instantaneous
+//
+const int ACTUATOR_RUN_ON_MS = 0;
@@ -10,9 +10,24 @@ public:
                       CONFIG_BUTTON_ON,
                       POWER_FAILED,
                       POWER_RESTORED,
-                      USER_COMMAND
+                      USER_COMMAND,
+                      LAZY_SAVE,
+                      ACTUATOR_DONE,
+                      NV_COMMITTED,     // data is 1 if the commit worked, 0 if it failed
+                      GAUGE_SLEW_DONE,  // the gauge needle got where setSlow() sent it
+                      NV_ZAP,           // the console wants the remembered settings erased
+                      RETRACT_SETTLED,  // the actuator has rested after the startup full retract
+
+                      COUNT             // not a message; the number of message types
     };
 
+    //
+    // Messages are queued in priority lanes.  pop() always drains the URGENT lane before
+    //  looking at the NORMAL lane, so power fail and trim switch events never wait behind
+    //  periodic traffic
+    //
+    enum Lane : uint8_t { URGENT, NORMAL, NUM_LANES };
+
     static CMessage     *alloc( Type, int optionalData = 0 );
     void                free();
 
@@ -28,12 +43,24 @@ public:
     static void         stop();     // stop message queueing
     static void         start();    // resume message queueing
 
+    static Lane         laneOf( Type t );
+    static bool         coalesces( Type t );        // at most one of these is ever pending
+    static void         printStats();               // dropped/coalesced counts per type
+
 private:
     ~CMessage()         {}
-    void                freeWithoutLock();
 
-    CMessage    *m_next;
-    Type        m_type;
-    uint        m_data;
-};
+    //
+    // Messages live in fixed rings (one per lane) and are never linked together.  Producers (ISRs and
+    //  the main loop) claim a slot with alloc() and publish it with push(); the single consumer pops in
+    //  order and hands the slot back with free().  See CMessage.cpp
+    //
+    static constexpr uint32_t   RING_SIZE = 16;                 // must be a power of two
+    static constexpr uint32_t   RING_MASK = RING_SIZE - 1;
+    static CMessage             m_ring[ NUM_LANES ][ RING_SIZE ];
 
+    volatile uint32_t   m_sequence;     // lap of the ring this slot is free for, +1 once published
+    uint32_t            m_position;     // position in the ring this slot was claimed for
+    Type                m_type;
+    uint                m_data;
+};
@@ -2,6 +2,8 @@
 #pragma once
 
 #include "hardware/pwm.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
 #include "hardware/clocks.h"
 #include "hardware/sync.h"
 #include "hardware/i2c.h"
@@ -9,11 +11,23 @@
 #include "hal.hpp"
 #include <stdarg.h>
 
+//
+// If set, called over and over while getcharTimeout() waits for the user, so a console prompt doesn't hold up
+//   whatever else the waiting loop is responsible for (the nonvolatile storage writes)
+//
+inline void (*consoleIdle)() = nullptr;
+
 //
 // Read a character from stdin, set 'success' accordingly
 //
 inline int getcharTimeout( bool& success, uint32_t timeout_us = 60*1000000 ) {
-	auto ch = getchar_timeout_us( timeout_us );
+    const auto deadline = make_timeout_time_us( timeout_us );
+    int ch;
+    do {
+        if( consoleIdle != nullptr )
+            consoleIdle();
+        ch = getchar_timeout_us( consoleIdle != nullptr ? MIN( timeout_us, 1000u ) : timeout_us );
+    } while( ch == PICO_ERROR_TIMEOUT && absolute_time_diff_us( get_absolute_time(), deadline ) > 0 );
     success = (ch != PICO_ERROR_TIMEOUT);
     if( success )
         putchar_raw( ch );
@@ -116,6 +130,22 @@ public:
     __force_inline ~CINTERRUPTS_OFF() { restore_interrupts( m_oldState ); }
 };
 
+//
+// The Cortex-M0+ has no LDREX/STREX, so a compare-and-swap takes the SDK's atomics hardware spinlock for the three
+//  instructions it takes.  That masks interrupts on this core and keeps the other core out, so it is safe between
+//  ISRs and loops on either core; it only ever spins for the other core's three instructions.  Returns true if
+//  'value' was 'expected' and is now 'desired'
+//
+__force_inline bool compareAndSwap( volatile uint32_t& value, uint32_t expected, uint32_t desired ) {
+    spin_lock_t * const lock = spin_lock_instance( PICO_SPINLOCK_ID_ATOMIC );
+    const uint32_t saved = spin_lock_blocking( lock );
+    const bool swapped = (value == expected);
+    if( swapped )
+        value = desired;
+    spin_unlock( lock, saved );
+    return swapped;
+}
+
 //
 // This is a basic callback timer.  Each one of these makes a new hardware timer, so interrupts
 //   can really start flying around!  Use CGlobalTimer whenever possible
@@ -164,16 +194,57 @@ private:
 };
 
 
+//
+// One of the RP2040's four hardware timer alarms.  Derive from this and override onAlarm()
+//  WARNING: onAlarm() is called at interrupt time
+//
+// The alarms are all spoken for:  the SDK's default alarm pool (sleep_ms(), COnTimer), CGlobalTimer,
+//  CActuator's stop and CI2C's deadline.  Another one panics at boot, so anything else that needs timing
+//  goes on CGlobalTimer as a COnTick
+//
+class CHardwareAlarm : private NonCopyable {
+    const uint  m_alarm;
+
+    inline static CHardwareAlarm *m_owners[ NUM_TIMERS ] = {};
+
+    static void dispatch( uint alarmNum ) {
+        if( alarmNum < NUM_TIMERS && m_owners[ alarmNum ] != nullptr )
+            m_owners[ alarmNum ]->onAlarm();
+    }
+
+public:
+    CHardwareAlarm() : m_alarm( hardware_alarm_claim_unused( true ) ) {
+        m_owners[ m_alarm ] = this;
+        hardware_alarm_set_callback( m_alarm, dispatch );
+    }
+    ~CHardwareAlarm() {
+        hardware_alarm_set_callback( m_alarm, nullptr );
+        m_owners[ m_alarm ] = nullptr;
+        hardware_alarm_unclaim( m_alarm );
+    }
+
+    //
+    // Call onAlarm() at 'when'.  Returns false (and onAlarm() won't be called) if 'when' has already passed
+    //
+    bool    at( absolute_time_t when )      { return !hardware_alarm_set_target( m_alarm, when ); }
+    void    cancel()                        { hardware_alarm_cancel( m_alarm ); }
+
+    virtual void onAlarm() = 0;
+};
+
 //
 // This makes one singular timer that can handle multiple callbacks.  All instances of this use the
-//  same hardware timer
+//  same hardware alarm
 //
 // Users should derive a private class from CGlobalTimer::COnTick and override the onTick() member.  Then
 //  call start(), stop(), etc..  in this derived private class to manage the callback.
 //
-class CGlobalTimer : private COnTimer {
-    typedef COnTimer super;
-
+// Each COnTick has its own period and phase.  Callbacks are kept sorted by their next deadline and the
+//  hardware alarm is programmed for the earliest one, so the ISR only runs callbacks that are due and
+//  doesn't fire at all between deadlines.  Deadlines sit on a grid of the callback's period (offset by
+//  its phase) so callbacks sharing a period are run from the same interrupt.
+//
+class CGlobalTimer : private NonCopyable {
 public:
     static CGlobalTimer& instance();
 
@@ -181,26 +252,50 @@ public:
         friend class CGlobalTimer;
         COnTick     *m_next;
         bool        m_inList;
+        uint32_t    m_periodUs;
+        uint32_t    m_phaseUs;
+        uint64_t    m_deadline;             // us since boot of the next call to onTick()
     public:
-        COnTick() : m_next( nullptr ), m_inList(false)      {}
+        COnTick( int ms = CGlobalTimer::msPerTick(), int phaseMs = 0 ) :
+            m_next( nullptr ), m_inList(false), m_periodUs( MAX( ms, 1 ) * 1000 ), m_phaseUs( phaseMs * 1000 ), m_deadline( 0 ) {}
         ~COnTick()                                          { stop(); }
 
         virtual void onTick()               = 0;
         void    start()                     { CINTERRUPTS_OFF intsOff; if( !m_inList) { CGlobalTimer::instance().add( *this ); m_inList = true; } }
         void    stop()                      { CINTERRUPTS_OFF intsOff; if( m_inList ) { CGlobalTimer::instance().remove( *this ); m_inList = false; } }
         bool    enabled() const             { return m_inList; }
-        int     msPerTick() const           { return CGlobalTimer::msPerTick(); }
+
+        //
+        // Start with the first call 'ms' from now rather than on the period grid.  Calling stop()
+        //  from onTick() makes this a one-shot
+        //
+        void    startIn( int ms )           { startInUs( ms * 1000u ); }
+        void    startInUs( uint32_t us )    { CINTERRUPTS_OFF intsOff; if( !m_inList) { CGlobalTimer::instance().addAt( *this, time_us_64() + us ); m_inList = true; } }
+        int     msPerTick() const           { return m_periodUs / 1000; }
+
+        //
+        // Change how often onTick() is called.  Takes effect at the next start()
+        //
+        void    setPeriod( int ms, int phaseMs = 0 )    { m_periodUs = MAX( ms, 1 ) * 1000; m_phaseUs = phaseMs * 1000; }
     };
 
-    static int  msPerTick()                 { return 20; }      // how often is each callback called?
+    static int  msPerTick()                 { return 20; }      // default period of each callback
     void        add( COnTick& callback );
+    void        addAt( COnTick& callback, uint64_t deadline );
     bool        remove( COnTick& callback );
 private:
-    COnTick *m_head;
-    int     m_msPerTick;
+    COnTick     *m_head;
+
+    struct myAlarm : public CHardwareAlarm {
+        CGlobalTimer &m_timer;
+        void onAlarm() override                     { m_timer.onAlarm(); }
+        myAlarm( CGlobalTimer &t ) : m_timer( t )   {}
+    } m_alarm;
 
     CGlobalTimer();
-    bool onTimer() override;
+    void        insert( COnTick& callback );
+    void        reprogram();
+    void        onAlarm();
 };
 
 //
@@ -261,6 +356,44 @@ public:
     CGPIO_IN( BoardPin::type_t p, bool enablePullUp = false ) : super( p, super::IN ) { if( enablePullUp ) super::setPullUp(); }
 };
 
+//
+// Routes GPIO edge interrupts to the object that owns the pin.  The SDK only has one GPIO callback
+//  per core, so everything that wants edge interrupts must come through here.
+//
+// Derive from this and override onEdge().  WARNING: onEdge() is called at interrupt time
+//
+class CGPIOEdge : private NonCopyable {
+    const int   m_pin;
+
+    inline static CGPIOEdge *m_owners[ NUM_BANK0_GPIOS ] = {};
+
+    static void dispatch( uint gpio, uint32_t events ) {
+        if( gpio < NUM_BANK0_GPIOS && m_owners[ gpio ] != nullptr )
+            m_owners[ gpio ]->onEdge( events );
+    }
+
+public:
+    CGPIOEdge( const CGPIOBase& gpio ) : m_pin( gpio.available() ? gpio.pin() : -1 ) {}
+    ~CGPIOEdge()                        { disableEdges(); if( m_pin >= 0 ) m_owners[ m_pin ] = nullptr; }
+
+    //
+    // 'events' is a mask of GPIO_IRQ_EDGE_FALL and/or GPIO_IRQ_EDGE_RISE.  Any edges that happened before
+    //   this call are discarded
+    //
+    void enableEdges( uint32_t events ) {
+        if( m_pin >= 0 ) {
+            m_owners[ m_pin ] = this;
+            gpio_set_irq_enabled_with_callback( m_pin, events, true, dispatch );
+        }
+    }
+    void disableEdges() {
+        if( m_pin >= 0 )
+            gpio_set_irq_enabled( m_pin, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, false );
+    }
+
+    virtual void onEdge( uint32_t events ) = 0;
+};
+
 //
 // An Output GPIO pin
 //
@@ -295,6 +428,18 @@ class CPWM : private NonCopyable {
     uint16_t    m_level;
     float       m_percent = 50;
 
+    //
+    // Dithering.  m_ditherLevel is the level we want in Q16.  fillDither() spreads its fraction over a ring of
+    //   compare values that DMA copies to CC on each PWM wrap, so the average level has 1/DITHER_STEPS count
+    //   resolution at the same carrier frequency and the CPU never hears about it
+    //
+    bool        m_dither = false;
+    uint32_t    m_ditherLevel = 0;
+    int         m_ditherDMA = -1;           // ring -> CC, paced by the slice's wrap
+    int         m_ditherReloadDMA = -1;     // restarts m_ditherDMA when its (very long) count runs out
+
+    void fillDither();
+
 public:
     CPWM( CGPIO_OUT& g, int hz, bool doEnable = false ) : m_gpio( g )
     {
@@ -327,7 +472,8 @@ public:
     }
 
     ~CPWM()
-    {   disable();
+    {   setDither( false );
+        disable();
         if( m_gpio.available() ) {
             gpio_init( m_gpio.pin() );
             m_gpio.setStrength();
@@ -339,12 +485,21 @@ public:
         m_percent = MIN( percent, 100 );
         m_percent = MAX( m_percent, 0 );
 
-        if( m_percent <= 0 )
-            m_level = 0;
-        else if( m_percent >= 100 )
-            m_level = m_top-1;
-        else
-            m_level = uint16_t( (m_percent * m_top / 100) + 0.5f) - 1;
+        m_level = levelFor( m_percent );
+
+        if( m_dither ) {
+            //
+            // Same level as above when it comes out even, the fraction that rounding threw away when it doesn't
+            //
+            uint32_t level = 0;
+            if( m_percent >= 100 )
+                level = uint32_t( m_top ) << 16;
+            else if( m_percent > 0 )
+                level = uint32_t( MAX( m_percent * m_top / 100 - 1, 0.0f ) * 65536 );
+            m_ditherLevel = level;
+            m_level = uint16_t( level >> 16 );
+            fillDither();
+        }
 
         if( m_gpio.available() ) {
             pwm_set_chan_level( m_slice, m_channel, m_level );
@@ -354,49 +509,89 @@ public:
     }
     float getPercent() const            { return m_percent; }
 
+    uint16_t levelFor( float percent ) const {
+        if( percent <= 0 )
+            return 0;
+        if( percent >= 100 )
+            return m_top;               // past the wrap, so the output never drops
+        return uint16_t( (percent * m_top / 100) + 0.5f) - 1;
+    }
+
+    //
+    // For writing the slice's compare register directly (CPWMCycler's DMA).  Both channels share the register
+    //
+    io_rw_32* ccRegister() const        { return &pwm_hw->slice[ m_slice ].cc; }
+    uint32_t ccFor( float percent ) const {
+        const uint shift = (m_channel == PWM_CHAN_B) ? 16 : 0;
+        return (*ccRegister() & ~(0xFFFFu << shift)) | (uint32_t( levelFor( percent ) ) << shift);
+    }
+
+    //
+    // Dither the level by DMA, for finer steps than the ~4000 counts of a 30kHz carrier.  There is one ring, so
+    //   only one PWM can dither at a time; false if another has it
+    //
+    static constexpr uint DITHER_STEPS = 32;        // a power of 2 for the DMA ring
+
+    bool setDither( bool on );
+    bool dithering() const              { return m_dither; }
+
+    //
+    // Drop the output to 0 without touching m_percent.  Safe to inline into RAM code while flash is busy
+    //
+    __force_inline void forceOff()      { if( m_gpio.available() ) pwm_set_chan_level( m_slice, m_channel, 0 ); }
+
     virtual void enable()               { if( m_gpio.available() ) { m_gpio.setOn(); pwm_set_enabled( m_slice, true ); } }
     virtual void disable()              { if( m_gpio.available() ) { m_gpio.setOff(); pwm_set_enabled( m_slice, false ); } }
 
     void print() const {
-        printf( "PWM pin %d: slice %u, divider %u.%u, top %u, percent %.2f%%, level %u\n",
+        printf( "PWM pin %d: slice %u, divider %u.%u, top %u, percent %.2f%%, level %u",
             m_gpio.pin(), m_slice, m_divider, m_frac, m_top, getPercent(), m_level );
+        if( m_dither )
+            printf( " + %u/%u dithered", ((m_ditherLevel & 0xFFFF) * DITHER_STEPS + 0x8000) >> 16, DITHER_STEPS );
+        printf( "\n" );
     }
 };
 
 //
 // This class makes the GPIO output port's PWM cycle between 'low Percent' duty and 'high Percent' duty cycle
-//   every secPerCycle seconds
+//   every secPerCycle seconds.  The whole cycle is computed up front into a table of compare register values
+//   which DMA copies to the PWM, one entry per step, paced by a DMA timer.  The CPU isn't involved once it starts
+//
+// There is one table, so only one cycler can run at a time.  The table holds the whole CC register, so the other
+//   channel of the slice is held where it was when the cycler was enabled
 //
 class CPWMCycler : private NonCopyable {
+public:
+    enum class shape_t : uint8_t { TRIANGLE, SINE, EASE };
+
+    static constexpr uint   TABLE_SIZE = 256;               // entries per cycle; a power of 2 for the DMA ring
+
+private:
     CPWM            &m_pwm;
     const float     m_secPerCycle;
     float           m_lowPercent = 0;
     float           m_highPercent = 100;
-    int             m_ticksPerPhase;
-    float           m_deltaPerTick;
-    bool            m_increasing = true;
-
-    struct myTick : public CGlobalTimer::COnTick {
-        CPWMCycler&     m_cycler;
-        void onTick() override                  { m_cycler.onTick(); }
-        myTick( CPWMCycler& p ) : m_cycler(p)   {}
-    } m_myTick;
-
-    CPWMCycler& setDeltaPerTick() {
-        m_deltaPerTick = (m_highPercent - m_lowPercent) / m_ticksPerPhase;
-        return *this;
-    }
+    shape_t         m_shape = shape_t::TRIANGLE;
+    bool            m_wasDithering = false;
+    int             m_dataDMA = -1;                         // table entry -> CC
+    int             m_paceDMA = -1;                         // counts DMA timer ticks between entries
+    int             m_timer = -1;
+
+    float percentAt( uint index ) const;
 
 public:
-    CPWMCycler( CPWM& pwm, float secPerCycle = 2 ) :
-        m_pwm(pwm), m_secPerCycle( secPerCycle ), m_myTick( *this ) {
+    CPWMCycler( CPWM& pwm, float secPerCycle = 2 ) : m_pwm(pwm), m_secPerCycle( secPerCycle ) {}
+    ~CPWMCycler()       { stop(); }
 
-        m_ticksPerPhase = int( ((1000 / m_myTick.msPerTick()) * secPerCycle) / 2 );
-        setDeltaPerTick();
-        }
+    bool enable();                          // false if another cycler has the table
+    void disable()      { stop(); m_pwm.disable(); }
+
+    //
+    // Stop the DMA and leave the PWM at the step it had reached
+    //
+    void stop();
 
-    void enable()       { m_pwm.enable(); m_myTick.start(); }
-    void disable()      { m_pwm.disable(); m_myTick.stop(); }
+    CPWMCycler& setShape( shape_t shape )   { m_shape = shape; return *this; }
 
     CPWMCycler& setPercents( float lowPercent, float highPercent ) {
             if( lowPercent < highPercent ) {
@@ -406,28 +601,53 @@ public:
                 m_lowPercent = highPercent;
                 m_highPercent = lowPercent;
             }
-            setDeltaPerTick();
             return *this;
     }
-
-    void onTick() {
-        auto percent = m_pwm.getPercent();
-        if( m_increasing ) {
-            if( (percent += m_deltaPerTick) >= m_highPercent ) {
-                percent = m_highPercent;
-                m_increasing = false;
-            }
-        } else {
-            if( (percent -= m_deltaPerTick) <= m_lowPercent ) {
-                percent = m_lowPercent;
-                m_increasing = true;
-            }
-        }
-        m_pwm.setPercent( percent );
-    }
 };
 
 
+//
+// Debounces one input pin on a PIO state machine (debounce.pio).  The state machine samples the pin sampleHz times
+//  a second and only pushes a level once settleUs worth of samples in a row agree, so bounces never reach the CPU.
+//  The RX FIFO interrupt on the core that enabled the pin reports the change.  Nothing runs on the CPU while the
+//  pin is quiet or bouncing, and changes wait in the FIFO while the core is parked for a flash write.
+//
+// Derive from this and override onChange().  WARNING: onChange() is called at interrupt time
+//
+class CDebouncer : private NonCopyable {
+    CGPIO_IN&           m_gpio;
+    const uint32_t      m_settleUs;
+    const uint32_t      m_samples;                  // samples in a row it takes to change the level
+    const uint32_t      m_sampleHz;
+    int                 m_sm = -1;                  // state machine, or -1 if the pin isn't there
+    volatile bool       m_level = true;             // debounced pin level
+    absolute_time_t     m_changedAt = nil_time;     // about when the pin started the run that made the last change
+
+    inline static CDebouncer    *m_owners[ NUM_PIO_STATE_MACHINES ] = {};
+    inline static int           m_programOffset = -1;
+    inline static int           m_programUsers = 0;
+
+    static void onFIFO();
+
+public:
+    static constexpr uint32_t   defaultSampleHz = 4000;
+
+    CDebouncer( CGPIO_IN& gpio, uint32_t settleUs, uint32_t sampleHz = defaultSampleHz );
+    ~CDebouncer();
+
+    //
+    // Start watching the pin, assuming it is at 'initialLevel'.  If it isn't, a change is reported once it settles
+    //
+    void enable( bool initialLevel );
+    void disable( bool restingLevel );
+
+    bool            level() const           { return m_level; }
+    bool            settling() const        { return m_sm >= 0 && m_gpio.read() != m_level; }
+    absolute_time_t changedAt() const       { return m_changedAt; }
+
+    virtual void onChange( bool level ) = 0;
+};
+
 //
 // A debounced pushbutton.  GPIO is set to input w/pullup.  When reads 0, the switch is closed
 //
@@ -435,28 +655,33 @@ public:
 //
 class CButton : private NonCopyable {
     CGPIO_IN    m_gpio;
-    uint8_t     m_switchState;
 
-    absolute_time_t		m_whenPressed;      // timestamp when button first pressed
-    int                 m_ms;               // how long was the switch pressed?
+    absolute_time_t		m_whenPressed = nil_time;   // timestamp when button first pressed
+    int                 m_ms;                       // how long was the switch pressed?
 
-    struct myTick : public CGlobalTimer::COnTick {
+    struct myDebouncer : public CDebouncer {
         CButton &m_btn;
-        void onTick() override                      { m_btn.onTick(); }
-        myTick( CButton &btn ) : m_btn( btn )       {}
-    } m_myTick;
+        void onChange( bool level ) override        { m_btn.onLevel( level ); }
+        myDebouncer( CButton &btn, uint32_t settleUs ) : CDebouncer( btn.m_gpio, settleUs ), m_btn( btn )  {}
+    } m_debouncer;
 
 public:
-    CButton( BoardPin::type_t p, bool enablePullup = true ) : m_gpio( p ), m_ms(0), m_myTick(*this) { if( enablePullup ) m_gpio.setPullUp(); }
+    CButton( BoardPin::type_t p, bool enablePullup = true, uint32_t settleUs = 20000 ) :
+        m_gpio( p ), m_ms(0), m_debouncer( *this, settleUs ) { if( enablePullup ) m_gpio.setPullUp(); }
+
+    void enable()           { m_debouncer.enable( true ); }
+    void disable()          { m_debouncer.disable( true ); }
 
-    void enable()           { m_switchState = 0xF; m_myTick.start(); }
-    void disable()          { m_switchState = 0xF; m_myTick.stop(); }
+    //
+    // True when the button is released and not bouncing
+    //
+    bool idle() const       { return released() && !m_debouncer.settling(); }
 
     //
     // Return the present debounced button state
     //
-    bool pressed() const    { return m_switchState == 0; }
-    bool released() const   { return m_switchState == 0x0F; }
+    bool pressed() const    { return m_debouncer.level() == false; }
+    bool released() const   { return m_debouncer.level() == true; }
 
     void waitForPressed() const         { while( !pressed() ) __wfi(); }
 
@@ -464,6 +689,7 @@ public:
     bool waitForReleased( int maxMS )   { while( !released() && ms() < maxMS ){ __wfi(); } return released(); }
 
     bool strobe() const     { return m_gpio == false; }     // true if currently depressed, false otherwise
+    absolute_time_t whenPressed() const { return m_whenPressed; }  // first edge of the last press
 
     //
     // Return the length of time the button is or was pressed
@@ -484,17 +710,13 @@ public:
     CGPIO_IN& gpio()    { return m_gpio; }
 
 private:
-    void onTick() {
-        const uint8_t newState = ((m_switchState << 1) | m_gpio.read()) & 0x0F;
-        if( newState != m_switchState ) {
-            m_switchState = newState;
-            if( released() ) {
-                m_ms = m_whenPressed != nil_time ? int( absolute_time_diff_us( m_whenPressed, get_absolute_time() ) / 1000 ) : 0;
-                onChange( false );
-            } else if( pressed() ) {
-                m_whenPressed = get_absolute_time();
-                onChange( true );
-            }
+    void onLevel( bool level ) {
+        if( level ) {
+            m_ms = m_whenPressed != nil_time ? int( absolute_time_diff_us( m_whenPressed, m_debouncer.changedAt() ) / 1000 ) : 0;
+            onChange( false );
+        } else {
+            m_whenPressed = m_debouncer.changedAt();
+            onChange( true );
         }
     }
 };
@@ -508,46 +730,49 @@ private:
 class CSPDT : private NonCopyable {
     CGPIO_IN    m_top, m_bottom;
 
-    union _switchState {
-        _switchState( uint8_t val = 0xFF ) : all(val) {}
-        struct {
-            uint8_t topBits : 4;
-            uint8_t botBits : 4;
-        };
-        uint8_t     all;
-    } m_switchState;
-
     bool        m_wasTop = false, m_wasBottom = false;
 
-    struct myTick : public CGlobalTimer::COnTick {
-        CSPDT &m_switch;
-        void onTick() override                      { m_switch.onTimer(); }
-        myTick( CSPDT &s ) : m_switch( s )          {}
-    } m_myTick;
+    struct myDebouncer : public CDebouncer {
+        CSPDT   &m_switch;
+        const bool m_isTop;
+        void onChange( bool level ) override        { m_switch.onLevel( m_isTop, level ); }
+        myDebouncer( CSPDT &s, CGPIO_IN &gpio, bool isTop, uint32_t settleUs ) :
+            CDebouncer( gpio, settleUs ), m_switch( s ), m_isTop( isTop ) {}
+    } m_topDebouncer, m_bottomDebouncer;
 
 public:
-    CSPDT( BoardPin::type_t t, BoardPin::type_t b) :
+    CSPDT( BoardPin::type_t t, BoardPin::type_t b, uint32_t settleUs = 5000 ) :
         m_top( t ),
         m_bottom( b ),
-        m_myTick( *this )
+        m_topDebouncer( *this, m_top, true, settleUs ),
+        m_bottomDebouncer( *this, m_bottom, false, settleUs )
     {
         m_top.setPullUp();
         m_bottom.setPullUp();
     }
 
     void enable() {
-        m_switchState.all = 0xFF;
-        m_myTick.start();
+        m_topDebouncer.enable( true );
+        m_bottomDebouncer.enable( true );
     }
     void disable() {
-        m_myTick.stop();
+        m_topDebouncer.disable( true );
+        m_bottomDebouncer.disable( true );
     }
 
+    //
+    // True when the switch is centered and not bouncing
+    //
+    bool idle() const       { return !top() && !bottom() && !m_topDebouncer.settling() && !m_bottomDebouncer.settling(); }
+
+    const CGPIO_IN& topGPIO() const     { return m_top; }
+    const CGPIO_IN& bottomGPIO() const  { return m_bottom; }
+
     //
     // Return true if the top or bottom portions of the switch are pressed
     //
-    bool top() const        { return m_switchState.topBits == 0; }
-    bool bottom() const     { return m_switchState.botBits == 0; }
+    bool top() const        { return m_topDebouncer.level() == false; }
+    bool bottom() const     { return m_bottomDebouncer.level() == false; }
 
     bool operator==( bool b ) const { return (top() || bottom()) == b; }
 
@@ -558,57 +783,121 @@ public:
     virtual void onTop( bool pressed )      { (void)pressed; }
     virtual void onBottom( bool pressed )   { (void)pressed; }
 private:
-    void onTimer() {
-        const auto oldState = m_switchState;
-
-        _switchState newState;
-        newState.topBits = (oldState.topBits << 1) | m_top.read();
-        newState.botBits = (oldState.botBits << 1) | m_bottom.read();
-
-        if( oldState.all != newState.all ) {
-            m_switchState = newState;
-
-            if( newState.topBits != oldState.topBits ) {
-                if( newState.topBits == 0 || newState.topBits == 0x0F ) {
-                    const bool isTop = (newState.topBits == 0);
-                    if( isTop != m_wasTop ) {
-                        if( m_wasBottom )
-                            onBottom( m_wasBottom = false );
-                        onTop( m_wasTop = isTop );
-                    }
-                }
-
-            } else if( newState.botBits != oldState.botBits ) {
-                if( newState.botBits == 0 || newState.botBits == 0x0F ) {
-                    const bool isBottom = (newState.botBits == 0);
-                    if( isBottom != m_wasBottom ) {
-                        if( m_wasTop )
-                            onTop( m_wasTop = false );
-                        onBottom( m_wasBottom = isBottom );
-                    }
-                }
+    void onLevel( bool isTop, bool level ) {
+        const bool pressed = (level == false);
+
+        if( isTop ) {
+            if( pressed != m_wasTop ) {
+                if( m_wasBottom )
+                    onBottom( m_wasBottom = false );
+                onTop( m_wasTop = pressed );
+            }
+        } else {
+            if( pressed != m_wasBottom ) {
+                if( m_wasTop )
+                    onTop( m_wasTop = false );
+                onBottom( m_wasBottom = pressed );
             }
         }
     }
 };
 
 class CI2C : private NonCopyable {
+public:
+    enum class state_t : uint8_t { IDLE, BUSY, DONE, FAILED };
+
+    //
+    // One piece of a gathered write
+    //
+    struct segment_t {
+        const void  *data;
+        uint16_t    bytes;
+    };
+
+private:
     const uint8_t       m_7BitAddr;
     const bool          m_available;
     const uint          m_sdaPin;
     const uint          m_sclPin;
     i2c_inst_t * const  m_i2c;
+    uint                m_hz;                   // the bus clock we settled on
+
+    struct {
+        uint32_t        count, failed;
+        uint32_t        lastBytes, lastUs, maxUs;
+        uint64_t        totalUs;
+    }                   m_stats;                // transaction times, for the console
 
-    static constexpr uint timeout_us = 1000000;
+    //
+    // The transfer under way.  The TX FIFO is fed straight from the caller's segments, a FIFO full at a time from
+    //   the TX_EMPTY interrupt, and then with the read commands.  DMA empties the RX FIFO into the caller's buffer.
+    //   The STOP or an abort interrupt ends it, or m_deadline does if the bus has gone quiet
+    //
+    static constexpr uint   maxSegments = 4;
+    segment_t           m_segments[ maxSegments ];
+    uint                m_numSegments = 0;
+    uint                m_segment = 0;          // the one we're sending from
+    uint                m_offset = 0;           // and where we're at in it
+    uint                m_readsToSend = 0;      // read commands yet to go in the FIFO
+    bool                m_restartRead = false;  // the first read follows a write
+    uint                m_toSend = 0;           // data/command words yet to go in the FIFO
+    int                 m_rxDMA = -1;
+    volatile state_t    m_state = state_t::IDLE;
+    bool                m_timedOut = false;
+    bool                m_recover = false;      // a transfer failed; free up the bus before the next one
+    uint8_t             m_health = 100;         // 0 to 100, knocked down by failures and built back by successes
+    uint64_t            m_startUs = 0;
+    uint                m_bytes = 0;
+
+    //
+    // Not a COnTick:  CGlobalTimer's list belongs to the trim, on the other core with TAPS_DUAL_CORE
+    //
+    struct CDeadline : public CHardwareAlarm {
+        CI2C&   m_i2c;
+        CDeadline( CI2C& i2c ) : m_i2c( i2c ) {}
+        void onAlarm() override             { m_i2c.m_timedOut = true; m_i2c.finish( false ); }
+    } m_deadline;
+
+    inline static CI2C  *m_owners[ 2 ] = {};    // by I2C block, for the interrupt handlers
+
+    static constexpr uint timeout_us = 10 * 1000;           // for the scan, which doesn't use DMA
+    static constexpr int  healthGain = 5;                   // per transfer that works
+    static constexpr int  healthLoss = 34;                  // per one that doesn't, so three in a row hit 0
+    static constexpr uint probeTimeout_us = 2000;
 
     void showError( const char *format... );
     bool reservedAddr( uint8_t addr ) const;
+    uint negotiate( uint maxHz );
+    void timed( uint64_t startUs, uint bytes, bool success );
+    uint32_t defaultTimeoutUs( uint bytes ) const;
+
+    bool start( const segment_t *segments, uint count, void *readData, uint16_t bytesToRead, uint32_t timeoutUs );
+    void feed();
+    void finish( bool success );
+    bool recoverBus();
+    void onInterrupt();
+    static void onInterrupt0()              { m_owners[0]->onInterrupt(); }
+    static void onInterrupt1()              { m_owners[1]->onInterrupt(); }
 
 public:
-    CI2C( uint8_t sevenBitAddr, BoardPin::type_t sdaPin, uint hz = 100 * 1000 );
+    //
+    // Run the bus at the fastest of 'maxHz', 400KHz and 100KHz that the slave answers at
+    //
+    CI2C( uint8_t sevenBitAddr, BoardPin::type_t sdaPin, uint maxHz = 100 * 1000 );
     ~CI2C();
 
     inline bool available() const   { return m_available; }
+    inline uint hz() const          { return m_hz; }
+
+    //
+    // How well the slave has been answering lately:  100 is perfect, 0 is a run of failures
+    //
+    inline uint health() const      { return m_health; }
+
+    //
+    // Print the bus clock and how long transactions have been taking
+    //
+    void printStats() const;
 
     //
     // Sweep through all 7-bit addresses to see if any slaves are present.  Print
@@ -616,21 +905,49 @@ public:
     //
     void scan();
 
+    //
+    // Start a transfer and return without waiting for it.  Nothing is copied, so the buffers have to stay put
+    //   until the transfer is finished.  Watch state() or call wait() for the result.  The interrupt that ends
+    //   the transfer does a __sev(), so a loop sitting in __wfe() gets to look.
+    //
+    // The transfer fails if it takes longer than 'timeoutUs'.  Zero allows twice what the bytes take on the
+    //   wire at hz(), plus a millisecond
+    //
+    bool startWriteRead( const void *writeData, uint8_t bytesToWrite, void *readData, uint16_t bytesToRead, uint32_t timeoutUs = 0 );
+    bool startWriteWrite( const void *writeData1, uint8_t bytesToWrite1, const void *writeData2, uint16_t bytesToWrite2, uint32_t timeoutUs = 0 );
+
+    //
+    // Write 'count' segments, one after the other, as a single transfer ending with a STOP
+    //
+    bool startWriteGather( const segment_t *segments, uint count, uint32_t timeoutUs = 0 );
+
+    state_t state() const           { return m_state; }
+    bool    busy() const            { return m_state == state_t::BUSY; }
+
+    //
+    // Wait for the transfer under way to finish.  Returns true if it succeeded
+    //
+    bool wait();
+
     //
     // Write 'bytesToWrite' to the slave, then turn around and read 'bytesToRead'.
     //  No bytes are written if 'bytesToWrite' is zero
     //  No bytes are read if 'bytesToRead' is zero
     //  STOP is issued after the operation
     //
-	bool writeRead( const void *writeData, uint8_t bytesToWrite, void *readData, uint16_t bytesToRead );
+	bool writeRead( const void *writeData, uint8_t bytesToWrite, void *readData, uint16_t bytesToRead ) {
+        return startWriteRead( writeData, bytesToWrite, readData, bytesToRead ) && wait();
+    }
 
     //
-    // Write 'writeData1' of 'bytesToWrite1' to the slave, followed by 'writeData2' of 'bytesToWrite2'.
-    //   If 'sendStop' then issue a stop when the writes are complete.
+    // Write 'writeData1' of 'bytesToWrite1' to the slave, followed by 'writeData2' of 'bytesToWrite2',
+    //   then STOP.
     //
     // Either 'bytesToWrite1' or 'bytesToWrite2' can be zero
     //
-	bool writeWrite( const void *writeData1, uint8_t bytesToWrite1, const void *writeData2, uint16_t bytesToWrite2, bool sendStop );
+	bool writeWrite( const void *writeData1, uint8_t bytesToWrite1, const void *writeData2, uint16_t bytesToWrite2 ) {
+        return startWriteWrite( writeData1, bytesToWrite1, writeData2, bytesToWrite2 ) && wait();
+    }
 
 	//
 	// These utility routines help read/write values to/from I2C slave registers
@@ -639,6 +956,6 @@ public:
 		return writeRead( &regNo, 1, outputBuffer, bytes );
 	}
 	bool writeRegister( uint8_t regNo, const void *buffer, uint8_t bytes ) {
-		return writeWrite( &regNo, 1, buffer, bytes, true );
+		return writeWrite( &regNo, 1, buffer, bytes );
 	}
-};
\ No newline at end of file
+};
@@ -1,40 +1,189 @@
 #include <stdio.h>
 #include <memory.h>
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
+#include "hardware/structs/timer.h"
 
 #include <cmath>
 
 #include "config.h"
 #include "util.hpp"
 #include "CGauge.hpp"
-#include "CNVFlash.hpp"
-#include "CNVFRAM.hpp"
 #include "taps.hpp"
 #include "CActuator.hpp"
+#include "CNVFlash.hpp"
+#include "CNVFRAM.hpp"
 #include "CPowerFail.hpp"
+#include "CCoreLink.hpp"
 
 void configure( CNVState&, CLED& statusLED, CButton& button, CSPDT& trimSwitch, CActuator&, CGauge& );
 void demoMode( CGauge&, CButton& stopButton );
 void doCommand( int ch, CNVState& );
 
+//
+// Count how often the main loop wakes from __wfi() so we can see what sitting idle costs us
+//
+static class CWakeups {
+    uint32_t    m_count = 0;            // wakeups since m_windowStart
+    uint32_t    m_perMinute = 0;        // rate over the last completed window
+    uint64_t    m_windowStart = 0;
+public:
+    void wake() {
+        ++m_count;
+        const uint64_t now = time_us_64();
+        if( now - m_windowStart >= 60 * 1000000ull ) {
+            m_perMinute = uint32_t( (m_count * 60 * 1000000ull) / (now - m_windowStart) );
+            m_count = 0;
+            m_windowStart = now;
+        }
+    }
+    void print() const {
+        printf( "\nWakeups: %u per minute, %u so far this minute\n", m_perMinute, m_count );
+    }
+} wakeups;
+
+//
+// FRAM if we have it, with the flash to fall back on should it start failing
+//
 static CNVState& findNVResource() {
     static CNVFRAM nvFRAM( I2C_ADDR::FRAM, BoardPin::FRAM_SDA );
-    if( nvFRAM.size() > 0 )
-        return nvFRAM;
-
     static CNVFlash nvFlash;
+
+    if( nvFRAM.size() > 0 ) {
+        nvFRAM.failOverTo( nvFlash );
+        return nvFRAM;
+    }
     return nvFlash;
 }
 
+//
+// Messages core 0 posts to the trim loop on core 1
+//
+struct coreMessage_t {
+    CMessage::Type  type;
+    int             data;
+};
+static CCoreFIFO< coreMessage_t, 8 > toTrimCore;
+
+//
+// While core 0 writes flash, core 1 is parked in RAM with its interrupts off, so the trim switch and power fail
+//   handlers can't run.  This stands in for them as far as the motor goes:  a power failure, or letting go of the
+//   trim switch for TRIM_SWITCH_SETTLE_US, cuts the motor.  Their messages still arrive once the interrupts are back
+//
+static struct trimWatch_t {
+    const CGPIO_IN  *top, *bottom, *powerFail;
+    CActuator       *actuator;
+    volatile bool   trimDriving;            // the trim switch, not a timed move, is running the motor
+    bool            released;
+    uint32_t        releasedSince;
+    uint32_t        lastLook;
+} trimWatch;
+
+static void __not_in_flash_func(onParkedTrimWatch)( void *context ) {
+    auto& w = *static_cast< trimWatch_t * >( context );
+    const uint32_t now = timer_hw->timerawl;
+
+    if( now - w.lastLook > 1000 )           // first look since we were parked
+        w.released = false;
+    w.lastLook = now;
+
+    if( w.powerFail->available() && gpio_get( w.powerFail->pin() ) == false ) {
+        w.actuator->cutMotor();
+        return;
+    }
+
+    if( !w.trimDriving )
+        return;
+    if( gpio_get( w.top->pin() ) && gpio_get( w.bottom->pin() ) ) {       // pulled up, so centered
+        if( !w.released ) {
+            w.released = true;
+            w.releasedSince = now;
+        } else if( now - w.releasedSince >= uint32_t( TRIM_SWITCH_SETTLE_US ) ) {
+            w.actuator->cutMotor();
+        }
+    } else {
+        w.released = false;
+    }
+}
+
+static void trim( CNVState& nvState );
+
+static uint64_t nvRestoredUs;               // how long after reset we had the saved actuator position
+static CNVState *nvResource;                // what findNVResource() picked
+
+//
+// Write anything queued for the nonvolatile storage and tell the trim how it went.  Only on the loop that owns
+//   the storage:  core 0 with TAPS_DUAL_CORE, the trim loop without.  Also runs while console prompts wait
+//
+static bool serviceNV() {
+    bool ok;
+    if( !nvResource->service( ok ) )
+        return false;
+#if TAPS_DUAL_CORE
+    toTrimCore.push( { CMessage::Type::NV_COMMITTED, ok } );
+#else
+    if( auto msg = CMessage::alloc( CMessage::Type::NV_COMMITTED, ok ); msg != nullptr )
+        msg->push();
+#endif
+    return true;
+}
+
+#if TAPS_DUAL_CORE
+static uint32_t core1Stack[ 8 * 1024 / sizeof(uint32_t) ];
+
+static void trimCore() {
+    CLOCKOUT_OTHER_CORE::victimInit();      // so core 0 can park us while it writes flash
+    trim( *nvResource );
+}
+
+//
+// Core 0 is the console:  USB in and out, console commands and the nonvolatile storage.  The trim queues what it
+//   wants saved with commitAsync() and we write it here, telling the trim how it went.  Saves go before the USB
+//   output, which can stall for a slow host, and carry on while a command prompts
+//
+static void consoleCore( CNVState& nvState ) {
+    while( true ) {
+        if( serviceNV() )
+            continue;
+        CConsoleLog::drain();
+        if( int ch = getchar_timeout_us(0); ch != PICO_ERROR_TIMEOUT ) {
+            doCommand( ch, nvState );
+            continue;
+        }
+        __wfe();
+    }
+}
+#endif
+
 int main()
 {
     stdio_init_all();
 
     CNVState&   nvState = findNVResource();
+    nvRestoredUs = time_us_64();
+    nvResource = &nvState;
+    nvState.publish();                      // before the trim, maybe on core 1, can change it
+    consoleIdle = []() { serviceNV(); };     // the console runs on the loop that writes the storage
+
+#if TAPS_DUAL_CORE
+    CConsoleLog::install();
+    multicore_launch_core1_with_stack( trimCore, core1Stack, sizeof(core1Stack) );
+    consoleCore( nvState );
+#else
+    trim( nvState );
+#endif
+    return 0;       // never gets here, but...
+}
+
+//
+// Run the trim tabs:  the actuator, the gauge, and the switches that drive them
+//
+static void trim( CNVState& nvState )
+{
     CLED        picoLED( BoardPin::STANDARD_LED );
     CLED        statusLED( BoardPin::STATUS_LED );
     CPowerFail  powerFail;
-    CActuator   actuator( ACTUATOR_FULL_TRANSIT_MS );
+    CActuator   actuator( nvState.motion().get() );
     CGauge      gauge( nvState.gaugeCal().get(), GAUGE_PWM_FREQ );
 
     bool        movedTrimSinceLastSave = false;
@@ -48,7 +197,7 @@ int main()
         CGPIO_OUT       m_switchEnable;     //  Must be set to output high on boards with optical switch isolators
     public:
         trimSwitch() :
-        super( BoardPin::TRIM_SWITCH_EXTEND, BoardPin::TRIM_SWITCH_RETRACT ),
+        super( BoardPin::TRIM_SWITCH_EXTEND, BoardPin::TRIM_SWITCH_RETRACT, TRIM_SWITCH_SETTLE_US ),
         m_switchEnable( BoardPin::TRIM_SWITCH_ENABLE )
         {
             m_switchEnable.setOn();
@@ -71,7 +220,7 @@ int main()
         typedef     CButton super;
         bool        m_messages;
     public:
-        ConfigButton() : super( BoardPin::CONFIG_PUSHBUTTON ), m_messages( false )  {}
+        ConfigButton() : super( BoardPin::CONFIG_PUSHBUTTON, true, CONFIG_BUTTON_SETTLE_US ), m_messages( false )  {}
         void onChange( bool b ) override {
             if( b && m_messages )
                 if( auto msg = CMessage::alloc( CMessage::Type::CONFIG_BUTTON_ON ) )
@@ -82,6 +231,9 @@ int main()
     } configButton;
     configButton.enable();          // no messages yet
 
+    trimWatch = { &spdt.topGPIO(), &spdt.bottomGPIO(), &powerFail.gpio(), &actuator, false, false, 0, 0 };
+    CLOCKOUT_OTHER_CORE::addWatch( onParkedTrimWatch, &trimWatch );
+
     //
     // This object posts a "HEARTBEAT" message once per second, and blinks the pico led
     //
@@ -89,30 +241,58 @@ int main()
         struct myTick : public CGlobalTimer::COnTick {
             heartBeat &m_me;
             void onTick() override                      { m_me.onTick(); }
-            myTick( heartBeat &m ) : m_me( m )          {}
+            myTick( heartBeat &m, int ms ) : COnTick( ms ), m_me( m )  {}
         } m_myTick;
 
-        const int   m_interval;
-        int         m_count;
-        CLED        &m_led;                 // LED to toggle every m_interval
-        bool        m_msg;                  // should we send message at m_interval?
+        CLED        &m_led;                 // LED to toggle every tick
+        bool        m_msg;                  // should we send message every tick?
 
     public:
-        heartBeat( int interval, CLED& led ) : m_myTick(*this), m_interval( interval ), m_count(0), m_led(led), m_msg(false) {}
-        void onTick()           {   if( --m_count <= 0 ) {
-                                        m_led.toggle();
-                                        m_count = m_interval;
-                                        if( m_msg )
-                                            if( auto msg = CMessage::alloc( CMessage::Type::HEARTBEAT ) )
-                                                msg->push();
-                                    }
-        
+        heartBeat( int intervalMs, CLED& led ) : m_myTick( *this, intervalMs ), m_led(led), m_msg(false) {}
+        void onTick()           {   m_led.toggle();
+                                    if( m_msg )
+                                        if( auto msg = CMessage::alloc( CMessage::Type::HEARTBEAT ) )
+                                            msg->push();
                                 };
 
         bool enableMessages()           { auto oval = m_msg; m_msg = true; m_myTick.start(); return oval; }
         bool disableMessages()          { auto oval = m_msg; m_msg = false; return oval; }
 
-    } heartBeat( 1000/CGlobalTimer::msPerTick(), picoLED );
+        //
+        // Stop ticking while nothing is going on, pick up again when something happens
+        //
+        void pause()                    { m_myTick.stop(); m_led = false; }
+        void resume()                   { if( m_msg ) m_myTick.start(); }
+
+    } heartBeat( 1000, picoLED );
+
+    //
+    // This object posts a "LAZY_SAVE" message once the actuator has sat still for ACTUATOR_POSITION_SAVE_DELAY_SEC.
+    //   It is a one-shot, so nothing ticks while we wait
+    //
+    class lazySave : public CGlobalTimer::COnTick {
+        void onTick() override {
+            stop();
+            if( auto msg = CMessage::alloc( CMessage::Type::LAZY_SAVE ) )
+                msg->push();
+        }
+    public:
+        void restart()                  { stop(); startIn( ACTUATOR_POSITION_SAVE_DELAY_SEC * 1000 ); }
+    } lazySave;
+
+    //
+    // This object posts a "RETRACT_SETTLED" message a moment after the startup full retract stops, so the
+    //   actuator rests before it's sent back to the lazily saved position.  The loop keeps running meanwhile
+    //
+    class retractSettle : public CGlobalTimer::COnTick {
+        void onTick() override {
+            stop();
+            if( auto msg = CMessage::alloc( CMessage::Type::RETRACT_SETTLED ) )
+                msg->push();
+        }
+    public:
+        void restart()                  { stop(); startIn( 100 ); }
+    } retractSettle;
 
     gauge.enable();
 
@@ -139,19 +319,50 @@ int main()
         }
     }
 
+    //
+    // Where are we in getting the actuator to its starting position?
+    //
+    enum class Startup { RETRACTING, SETTLING, RESTORING, DONE } startup = Startup::DONE;
+
     if( isnan( recoveredActuatorPercent ) ) {
         //
         // Don't know where the actuator is/was, so best we can do is reset it
         //
 	    actuator.startFullRetract();
+        startup = Startup::RETRACTING;
     }
 
+    //
+    // The actuator is where it belongs....hand it over to the trim switch
+    //
+    auto handOver = [&]() {
+        gauge.setSlow( actuator.percent() );
+        statusLED = false;
+        spdt.enable();
+        CMessage::flush();
+        configButton.enableMessages();
+    };
+
     heartBeat.enableMessages();
-    gauge.setSlow( actuator.percent() );
+    gauge.thenSlow( actuator.percent() );       // after the sweep to 100, if we're doing that
 
     while (true) {
         auto msg = CMessage::pop();
         if( msg == nullptr ) {
+#if TAPS_DUAL_CORE
+            if( coreMessage_t m; toTrimCore.pop( m ) ) {
+                if( msg = CMessage::alloc( m.type, m.data ); msg != nullptr )
+                    msg->push();
+                continue;
+            }
+            __wfe();                // core 0 wakes us with __sev()
+#else
+            //
+            // Saves queued with commitAsync() wait until the motor is off, so a write never holds up a stop,
+            //   unless the storage writes in the background
+            //
+            if( (nvState.writesInBackground() || actuator.active() == false) && serviceNV() )
+                continue;
             if( int ch = getchar_timeout_us(0); ch != PICO_ERROR_TIMEOUT ) {
                 if( actuator.active() == false ) {
                     if( msg = CMessage::alloc( CMessage::Type::USER_COMMAND, ch ); msg != nullptr )
@@ -160,15 +371,21 @@ int main()
                 continue;
             }
             __wfi();
+#endif
+            wakeups.wake();
             continue;
         }
 
+        if( msg->type() != CMessage::Type::HEARTBEAT )
+            heartBeat.resume();
+
         switch( msg->type() ) {
         case CMessage::Type::TRIM_TOP_ON:
             movedTrimSinceLastSave = true;
             ++numberOfTrimMovements;
             statusLED = true;
             actuator.retract();
+            trimWatch.trimDriving = true;
             configButton.disableMessages();
             break;
 
@@ -177,21 +394,26 @@ int main()
             ++numberOfTrimMovements;
             statusLED = true;
             actuator.extend();
+            trimWatch.trimDriving = true;
             configButton.disableMessages();
             break;
 
         case CMessage::Type::TRIM_OFF:
+            trimWatch.trimDriving = false;
             statusLED = false;
             actuator.stop();
             gauge.set( actuator.percent() );
 
             if( nvState.unlimitedUpdates() ) {
-                nvState.setActuatorPercent( actuator.percent(), CNVState::SavedPositionImmediate ).commit();
+                nvState.setActuatorPercent( actuator.percent(), CNVState::SavedPositionImmediate ).commitAsync();
                 movedTrimSinceLastSave = false;
             } else if( numberOfTrimMovements == 1 ) {
-                nvState.setActuatorPercent( actuator.percent(), CNVState::InitialMovement ).commit();
+                nvState.setActuatorPercent( actuator.percent(), CNVState::InitialMovement ).commitAsync();
             }
 
+            if( nvState.unlimitedUpdates() == false && !powerFail.available() )
+                lazySave.restart();
+
             configButton.enableMessages();
             break;
 
@@ -224,25 +446,7 @@ int main()
             break;
 
         case CMessage::Type::FULL_RETRACT:
-            statusLED = true;
-            if( actuator.activeTime() >= actuator.targetRullRetractRunTime() ) {
-                actuator.stop();
-                sleep_ms( 100 );
-                if( nvState.reason().get() == CNVState::SavedPositionLazy && !nvState.closeEnough( actuator.percent() ) ) {
-                        gauge.setSlow( actuator.percent() );
-                        if( nvState.actuatorPercent().get() >= 0 && nvState.actuatorPercent().get() <= 100 ) {
-                            actuator.extend( false );
-                            for( auto pct = actuator.percent(); !nvState.closeEnough(pct) && pct < nvState.actuatorPercent().get(); pct = actuator.percent() )
-                                gauge.set( pct );
-                            actuator.stop();
-                        }
-                }
-                gauge.setSlow( actuator.percent() );
-                statusLED = false;
-                spdt.enable();
-                msg->flush();
-                configButton.enableMessages();
-            } else {
+            {
                 //
                 // We want a sweep of the TAPS gauge while the actuator is doing its initial retraction
                 //
@@ -250,6 +454,7 @@ int main()
                 const static auto deltaPercentPerTick = 2 * (100 / ticksForRetract);
                 static bool gaugeSweepIncreasing = true;
 
+                statusLED = true;
                 auto currentGauge = gauge.get();
                 if( currentGauge >= 99 )
                     gaugeSweepIncreasing = false;
@@ -260,35 +465,97 @@ int main()
             }
             break;
 
+        case CMessage::Type::ACTUATOR_DONE:
+            gauge.set( actuator.percent() );
+
+            if( startup == Startup::RETRACTING ) {
+                //
+                // Fully retracted.  Let it rest, then RETRACT_SETTLED decides what's next
+                //
+                startup = Startup::SETTLING;
+                retractSettle.restart();
+                break;
+            } else if( startup == Startup::RESTORING ) {
+                startup = Startup::DONE;
+            } else {
+                break;
+            }
+
+            handOver();
+            break;
+
+        case CMessage::Type::RETRACT_SETTLED:
+            if( startup != Startup::SETTLING )
+                break;
+
+            //
+            // If the last position was lazily saved, go back to it
+            //
+            startup = Startup::DONE;
+            if( nvState.reason().get() == CNVState::SavedPositionLazy && !nvState.closeEnough( actuator.percent() ) ) {
+                gauge.setSlow( actuator.percent() );
+                if( nvState.actuatorPercent().get() >= 0 && nvState.actuatorPercent().get() <= 100 &&
+                    actuator.moveTo( nvState.actuatorPercent().get() ) ) {
+                    startup = Startup::RESTORING;
+                    break;
+                }
+            }
+
+            handOver();
+            break;
+
         case CMessage::Type::HEARTBEAT:
-            if( nvState.unlimitedUpdates() == false && !powerFail.available() && spdt == false ) {
-                if( movedTrimSinceLastSave && actuator.secondsSinceLastStop() >= ACTUATOR_POSITION_SAVE_DELAY_SEC ) {
-                    movedTrimSinceLastSave = false;
-                    if( !nvState.closeEnough( actuator.percent() ) ) {
-                        statusLED.toggle();
-                        nvState.setActuatorPercent( actuator.percent(), CNVState::SavedPositionLazy ).commit();
-                        sleep_ms(100);
-                        statusLED.toggle();
-                    }
+            //
+            // Nothing moving and nobody touching anything....stop ticking until a switch edge wakes us
+            //
+            if( actuator.active() == false && spdt.idle() && configButton.idle() )
+                heartBeat.pause();
+            break;
+
+        case CMessage::Type::LAZY_SAVE:
+            //
+            // If the trim is moving again, the next TRIM_OFF will restart the lazy save timer
+            //
+            if( spdt == false && actuator.active() == false && movedTrimSinceLastSave ) {
+                movedTrimSinceLastSave = false;
+                if( !nvState.closeEnough( actuator.percent() ) ) {
+                    statusLED.toggle();
+                    nvState.setActuatorPercent( actuator.percent(), CNVState::SavedPositionLazy ).commitAsync();
+                    sleep_ms(100);
+                    statusLED.toggle();
                 }
             }
             break;
 
-        case CMessage::Type::POWER_FAILED:
+        case CMessage::Type::POWER_FAILED: {
+            //
+            // The hold-up capacitor is draining; save first and talk about it later
+            //
+            bool savedFailed = false;
             actuator.stop();
+            if( movedTrimSinceLastSave ) {
+                nvState.setActuatorPercent( actuator.percent(), CNVState::PowerDownSave ).commitAsync();
+                movedTrimSinceLastSave = false;
+                numberOfTrimMovements = 0;
+            }
+#if !TAPS_DUAL_CORE
+            //
+            // We're the writer, and the loop won't get back to it before the USB printing below
+            //
+            if( bool ok; nvState.flush( ok ) && !ok )
+                savedFailed = true;
+#endif
             gauge.disable();
-            printf( "*** POWER FAILURE ***\n");
             configButton.disableMessages();
             heartBeat.disableMessages();
             CMessage::flush();
             picoLED = true;
             statusLED = true;
-            if( movedTrimSinceLastSave ) {
-                nvState.setActuatorPercent( actuator.percent(), CNVState::PowerDownSave ).commit();
-                movedTrimSinceLastSave = false;
-                numberOfTrimMovements = 0;
-            }
+            printf( "*** POWER FAILURE ***\n");
+            if( savedFailed )
+                printf( "*** NV COMMIT FAILED ***\n" );
             break;
+        }
 
         case CMessage::Type::POWER_RESTORED:
             printf( "*** POWER RESTORED ***\n" );
@@ -302,13 +569,25 @@ int main()
             heartBeat.enableMessages();
             break;
 
+        case CMessage::Type::GAUGE_SLEW_DONE:
+            break;                  // nothing here waits for the needle
+
+        case CMessage::Type::NV_COMMITTED:
+            if( msg->data() == 0 )
+                printf( "*** NV COMMIT FAILED ***\n" );
+            break;
+
+        case CMessage::Type::NV_ZAP:
+            nvState.zapAsync();
+            printf( "\nzapped!\n");
+            break;
+
         default:
             msg->print();
             break;
         }
         msg->free();
     }
-    return 0;       // never gets here, but...
 }
 
 //
@@ -364,13 +643,76 @@ void calibrateGauge( CNVState& nvState, CButton& button, CSPDT& trimSwitch, CGau
         return;
     }
 
-    nvState.setGaugeCal( gaugeCal ).commit();
+    nvState.setGaugeCal( gaugeCal ).commitAsync();
     gauge.calibrate( gaugeCal );
 }
 
+//
+// Learn how the actuator moves.  Starting fully retracted, we extend and then retract it while the owner presses
+//   the config button when the tab starts moving and again when it stops at the end of its travel.  The owner's
+//   reaction time drops out of the stroke times but not the start lag, so we take OWNER_REACTION_MS off that.
+//
+// Returns false if the owner held the button down or wandered off, in which case we don't know where the actuator is
+//
+bool learnMotion( CNVState& nvState, CButton& button, CActuator& actuator ) {
+    auto waitForPress = [&button]( absolute_time_t& pressedAt ) {
+        const auto giveUp = make_timeout_time_ms( CONFIG_INACTIVITY_ABORT_SEC * 1000 );
+        while( !button.pressed() ) {
+            if( time_reached( giveUp ) )
+                return false;
+            __wfi();
+        }
+        pressedAt = button.whenPressed();
+        return button.waitForReleased( CONFIG_ABORT_MS );
+    };
+
+    printf( "\nPress the button when the tab starts moving, and again when it stops\n" );
+    button.waitForReleased();
+
+    CActuator::motion_t motion = actuator.motion();
+    int startLagUs[2];
+
+    for( int direction : { 1, -1 } ) {
+        absolute_time_t started, moving, stopped;
+
+        started = get_absolute_time();
+        if( direction > 0 )
+            actuator.extend( false );
+        else
+            actuator.retract( false );
+        actuator.stopAfter( CActuator::maxStrokeUs() );       // don't lean on the end stop if the owner walks away
+
+        bool ok = waitForPress( moving ) && waitForPress( stopped );
+        if( ok && !actuator.active() ) {
+            printf( "\n** Stopped at the longest stroke we'd accept\n" );
+            ok = false;
+        }
+        actuator.stop();
+        if( !ok )
+            return false;
+
+        const int strokeUs = int( absolute_time_diff_us( moving, stopped ) );
+        (direction > 0 ? motion.extendUs : motion.retractUs) = strokeUs;
+        startLagUs[ direction > 0 ] = MAX( int( absolute_time_diff_us( started, moving ) ) - OWNER_REACTION_MS * 1000, 0 );
+        printf( "  %s: %.3f S\n", direction > 0 ? "extend" : "retract", strokeUs / 1e6f );
+    }
+    motion.startLagUs = (startLagUs[0] + startLagUs[1]) / 2;
+
+    actuator.setAlreadyAtPercent( 0 );
+    if( !CActuator::isValidMotion( motion ) ) {
+        printf( "\n** REJECTED!\n" );
+        return true;
+    }
+
+    nvState.setMotion( motion ).commitAsync();
+    actuator.setMotion( motion );
+    return true;
+}
+
 //
 // Make the status LED pulsate and let the user calibrate the trim gauge.  Retract the actuator along
-//   the way to allow the user to verify the actuator leads are correct (i.e. they may be reversed)
+//   the way to allow the user to verify the actuator leads are correct (i.e. they may be reversed),
+//   and learn how fast it moves each way
 //
 void configure( CNVState& nvState, CLED& statusLED, CButton& button, CSPDT& trimSwitch, CActuator& actuator, CGauge& gauge ) {
     const auto initialActuatorPercent = actuator.percent();
@@ -379,16 +721,23 @@ void configure( CNVState& nvState, CLED& statusLED, CButton& button, CSPDT& trim
         // Fully retract the actuator so the owner can know the motor is hooked up right
         //
         actuator.startFullRetract(false);
-        while( actuator.activeTime() < actuator.targetRullRetractRunTime() )
-            ;
-        actuator.stop();
+        actuator.waitForStop();
+
+        //
+        // Time the stroke both ways while the status LED is solid.  If the owner bails, home the actuator again
+        //
+        statusLED = true;
+        if( !learnMotion( nvState, button, actuator ) ) {
+            actuator.startFullRetract(false);
+            actuator.waitForStop();
+        }
 
         //
         // Let the owner adjust the gauge settings
         //
         CPWM statusPWM( statusLED, 1000 );
         CPWMCycler ledCycler( statusPWM, 2 );
-        ledCycler.setPercents( 5, 100 ).enable();
+        ledCycler.setPercents( 5, 100 ).setShape( CPWMCycler::shape_t::SINE ).enable();
         calibrateGauge( nvState, button, trimSwitch, gauge );
     }
     statusLED = false;
@@ -396,12 +745,8 @@ void configure( CNVState& nvState, CLED& statusLED, CButton& button, CSPDT& trim
     //
     // Restore the actuator to its initial position
     //
-    if( actuator.percent() != initialActuatorPercent ) {
-        actuator.extend( false );
-        while( actuator.percent() < initialActuatorPercent )
-            ;
-        actuator.stop();
-    }
+    if( actuator.moveTo( initialActuatorPercent, false ) )
+        actuator.waitForStop();
 
     //
     // Set the gauge to the actuator position
@@ -416,6 +761,7 @@ void configure( CNVState& nvState, CLED& statusLED, CButton& button, CSPDT& trim
 //
 void demoMode( CGauge& gauge, CButton& stopButton ) {
     auto origPercent = gauge.enable().get();
+    gauge.set( origPercent );               // stops any slew, so it doesn't fight the cycler
     {
         CPWMCycler cycler( gauge.pwm(), 1.5*ACTUATOR_FULL_TRANSIT_MS/1000.0 );
         cycler.setPercents( gauge.getLowPercent(), gauge.getHighPercent() ).enable();
@@ -433,14 +779,30 @@ void doCommand( int cmd, CNVState& nvState ) {
     if( cmd != '\r' ) {
         switch( cmd = tolower(cmd) ) {
         case 'z':               // zap the NV state
+            //
+            // The trim owns the settings and may be saving them on the other core, so it does the zapping
+            //
             if( areYouSure( "\nErase all remembered settings...") ) {
-                nvState.zap();
-                printf( "\nzapped!\n");
+#if TAPS_DUAL_CORE
+                toTrimCore.push( { CMessage::Type::NV_ZAP, 0 } );
+#else
+                if( auto msg = CMessage::alloc( CMessage::Type::NV_ZAP ); msg != nullptr )
+                    msg->push();
+#endif
             }
             break;
 
         case 'p':               // print the non-volatile storage state
             nvState.print();
+            printf( "Restored %llu uS after reset\n", nvRestoredUs );
+            break;
+
+        case 'q':               // print message queue statistics
+            CMessage::printStats();
+            break;
+
+        case 'u':               // print how often the main loop wakes up ('w' is the FRAM's write)
+            wakeups.print();
             break;
 
         default:              // fool with nonvolatile's i2c
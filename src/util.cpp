@@ -1,8 +1,10 @@
-
 #include <stdio.h>
 #include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/pio.h"
 
 #include    "util.hpp"
+#include    "debounce.pio.h"
 
 CGlobalTimer& CGlobalTimer::instance() {
     static CGlobalTimer globalTimer;
@@ -11,30 +13,70 @@ CGlobalTimer& CGlobalTimer::instance() {
 }
 
 
-CGlobalTimer::CGlobalTimer() : super( msPerTick() ), m_head( nullptr ) {
+CGlobalTimer::CGlobalTimer() : m_head( nullptr ), m_alarm( *this ) {
+}
+
+//
+// Link 'callback' into the list, keeping the list sorted by deadline.  Interrupts must be off
+//
+void CGlobalTimer::insert( COnTick& callback ) {
+    COnTick **pp = &m_head;
+    while( *pp != nullptr && (*pp)->m_deadline <= callback.m_deadline )
+        pp = &(*pp)->m_next;
+    callback.m_next = *pp;
+    *pp = &callback;
+}
+
+//
+// Point the hardware alarm at the earliest deadline.  If that deadline has already passed
+//  the SDK won't arm the alarm, so aim it just ahead of now instead.  Interrupts must be off
+//
+void CGlobalTimer::reprogram() {
+    if( m_head == nullptr ) {
+        m_alarm.cancel();
+        return;
+    }
+
+    for( auto deadline = m_head->m_deadline; !m_alarm.at( from_us_since_boot( deadline ) ); )
+        deadline = time_us_64() + 10;
 }
 
 void CGlobalTimer::add( COnTick& callback ) {
     CINTERRUPTS_OFF intsOff;
-    callback.m_next = m_head;
-    m_head = &callback;
-    super::start();
+
+    //
+    // First deadline is the next point on the callback's period grid
+    //
+    const uint64_t now = time_us_64();
+    uint64_t deadline = callback.m_phaseUs;
+    if( now >= callback.m_phaseUs )
+        deadline += ((now - callback.m_phaseUs) / callback.m_periodUs + 1) * callback.m_periodUs;
+
+    addAt( callback, deadline );
+}
+
+void CGlobalTimer::addAt( COnTick& callback, uint64_t deadline ) {
+    CINTERRUPTS_OFF intsOff;
+
+    callback.m_deadline = deadline;
+    insert( callback );
+    if( m_head == &callback )
+        reprogram();
 }
 
 bool CGlobalTimer::remove( COnTick& callback ) {
     CINTERRUPTS_OFF intsOff;
 
-    for( COnTick *ptr = m_head, *prev = nullptr; ptr; prev = ptr, ptr = ptr->m_next ) {
-        if( ptr == &callback ) {
-            if( prev != nullptr )
-                prev->m_next = ptr->m_next;
-            else {
-                m_head = ptr->m_next;
-                if( m_head == nullptr )
-                    super::stop();
-            }
-
-            ptr->m_next = nullptr;
+    for( COnTick **pp = &m_head; *pp != nullptr; pp = &(*pp)->m_next ) {
+        if( *pp == &callback ) {
+            *pp = callback.m_next;
+            callback.m_next = nullptr;
+
+            //
+            // No need to reprogram if this wasn't the head; an early alarm would just find nothing to do
+            //
+            if( m_head == nullptr )
+                reprogram();
             return true;
         }
     }
@@ -43,10 +85,289 @@ bool CGlobalTimer::remove( COnTick& callback ) {
 }
 
 //
-// Called at interrupt time
+// Called at interrupt time.  Run everything that is due, then sleep until the next deadline
 //
-bool CGlobalTimer::onTimer() {
-    for( auto ptr = m_head; ptr != nullptr; ptr = ptr->m_next )
+void CGlobalTimer::onAlarm() {
+    uint64_t now = time_us_64();
+    while( COnTick * const ptr = m_head ) {
+        if( ptr->m_deadline > now ) {
+            if( m_alarm.at( from_us_since_boot( ptr->m_deadline ) ) )
+                break;
+            now = time_us_64();         // deadline passed while we were busy; keep going
+            continue;
+        }
+
+        m_head = ptr->m_next;
+        ptr->m_next = nullptr;
+
         ptr->onTick();
+
+        //
+        // onTick() may have stopped itself, in which case it is no longer m_inList
+        //
+        if( ptr->m_inList ) {
+            ptr->m_deadline += ptr->m_periodUs;
+            if( ptr->m_deadline <= now )
+                ptr->m_deadline = now + ptr->m_periodUs;      // we fell behind;  drop the missed ticks
+            insert( *ptr );
+        }
+    }
+}
+
+//
+// CPWM dithering.  The ring is in RAM and aligned to its size for the DMA ring
+//
+static uint32_t     s_ditherRing[ CPWM::DITHER_STEPS ] __attribute__(( aligned( CPWM::DITHER_STEPS * sizeof(uint32_t) ) ));
+static const uint32_t s_ditherCount = 0xFFFFFFFF;
+static CPWM         *s_ditherOwner = nullptr;
+
+//
+// Spread the fraction evenly over the ring, Bresenham style, so the extra counts don't bunch up into a low
+//   frequency the gauge can follow.  The DMA may read a half-updated ring; that's one ring's worth of mix
+//
+void CPWM::fillDither() {
+    uint32_t whole = m_ditherLevel >> 16;
+    uint32_t extra = ((m_ditherLevel & 0xFFFF) * DITHER_STEPS + 0x8000) >> 16;
+    if( extra == DITHER_STEPS ) {
+        ++whole;
+        extra = 0;
+    }
+
+    const uint shift = (m_channel == PWM_CHAN_B) ? 16 : 0;
+    const uint32_t other = *ccRegister() & ~(0xFFFFu << shift);
+    for( uint i = 0; i < DITHER_STEPS; ++i ) {
+        const uint32_t level = whole + ((i + 1) * extra / DITHER_STEPS - i * extra / DITHER_STEPS);
+        s_ditherRing[i] = other | (level << shift);
+    }
+}
+
+//
+// The data channel writes a ring entry to CC each time the slice wraps.  When its count runs out (after a day
+//   or so) it chains to the reload channel, which writes its count and triggers it again
+//
+bool CPWM::setDither( bool on ) {
+    if( !m_gpio.available() || on == m_dither )
+        return true;
+
+    if( on ) {
+        if( s_ditherOwner != nullptr )
+            return false;
+        s_ditherOwner = this;
+        m_dither = true;
+        setPercent( m_percent );
+
+        m_ditherDMA = dma_claim_unused_channel( true );
+        m_ditherReloadDMA = dma_claim_unused_channel( true );
+
+        dma_channel_config c = dma_channel_get_default_config( m_ditherDMA );
+        channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+        channel_config_set_read_increment( &c, true );
+        channel_config_set_write_increment( &c, false );
+        channel_config_set_ring( &c, false, __builtin_ctz( sizeof(s_ditherRing) ) );
+        channel_config_set_dreq( &c, pwm_get_dreq( m_slice ) );
+        channel_config_set_chain_to( &c, m_ditherReloadDMA );
+        dma_channel_configure( m_ditherDMA, &c, ccRegister(), s_ditherRing, s_ditherCount, false );
+
+        c = dma_channel_get_default_config( m_ditherReloadDMA );
+        channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+        channel_config_set_read_increment( &c, false );
+        channel_config_set_write_increment( &c, false );
+        dma_channel_configure( m_ditherReloadDMA, &c, &dma_hw->ch[ m_ditherDMA ].al1_transfer_count_trig, &s_ditherCount, 1, false );
+
+        dma_channel_start( m_ditherDMA );
+    } else {
+        dma_channel_config c = dma_get_channel_config( m_ditherDMA );
+        channel_config_set_chain_to( &c, m_ditherDMA );
+        dma_channel_set_config( m_ditherDMA, &c, false );
+        dma_channel_abort( m_ditherReloadDMA );
+        dma_channel_abort( m_ditherDMA );
+        dma_channel_unclaim( m_ditherReloadDMA );
+        dma_channel_unclaim( m_ditherDMA );
+        m_ditherDMA = m_ditherReloadDMA = -1;
+
+        m_dither = false;
+        s_ditherOwner = nullptr;
+        setPercent( m_percent );
+    }
     return true;
 }
+
+//
+// CPWMCycler.  The table is in RAM and aligned to its size so the data channel's read can ring through it
+//
+static uint32_t     s_cycleTable[ CPWMCycler::TABLE_SIZE ] __attribute__(( aligned( CPWMCycler::TABLE_SIZE * sizeof(uint32_t) ) ));
+static uint32_t     s_paceDummy;
+static CPWMCycler   *s_cycleOwner = nullptr;
+
+//
+// Where in the cycle 'index' is, as a percent between the low and high percents
+//
+float CPWMCycler::percentAt( uint index ) const {
+    constexpr uint half = TABLE_SIZE / 2;
+    const float u = float( index < half ? index : TABLE_SIZE - index ) / half;
+
+    float f = u;
+    if( m_shape == shape_t::SINE )
+        f = (1 - cosf( float(M_PI) * u )) / 2;
+    else if( m_shape == shape_t::EASE )
+        f = u * u * (3 - 2 * u);
+    return m_lowPercent + f * (m_highPercent - m_lowPercent);
+}
+
+//
+// The pacing channel moves 'ticks' dummy words at the DMA timer's rate, then chains to the data channel, which
+//   writes one table entry and chains back.  Retriggering reloads each channel's count but not the data channel's
+//   read address, so it steps through the table and rings back to the start
+//
+bool CPWMCycler::enable() {
+    if( s_cycleOwner != nullptr && s_cycleOwner != this )
+        return false;
+    stop();
+    s_cycleOwner = this;
+
+    m_wasDithering = m_pwm.dithering();
+    m_pwm.setDither( false );           // the wrap interrupt would fight the DMA for the compare register
+    m_pwm.enable();
+    for( uint i = 0; i < TABLE_SIZE; ++i )
+        s_cycleTable[i] = m_pwm.ccFor( percentAt( i ) );
+
+    //
+    // Slowest DMA timer is clk_sys/65535, so long steps count several timer ticks
+    //
+    const float clocksPerStep = float( clock_get_hz( clk_sys ) ) * m_secPerCycle / TABLE_SIZE;
+    uint32_t ticks = MAX( uint32_t( clocksPerStep / 0xFFFF + 0.5f ), 1u );
+    const uint16_t divisor = uint16_t( MIN( MAX( clocksPerStep / ticks + 0.5f, 1.0f ), float( 0xFFFF ) ) );
+
+    m_timer = dma_claim_unused_timer( true );
+    m_dataDMA = dma_claim_unused_channel( true );
+    m_paceDMA = dma_claim_unused_channel( true );
+    dma_timer_set_fraction( m_timer, 1, divisor );
+
+    dma_channel_config c = dma_channel_get_default_config( m_dataDMA );
+    channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+    channel_config_set_read_increment( &c, true );
+    channel_config_set_write_increment( &c, false );
+    channel_config_set_ring( &c, false, __builtin_ctz( sizeof(s_cycleTable) ) );
+    channel_config_set_dreq( &c, DREQ_FORCE );
+    channel_config_set_chain_to( &c, m_paceDMA );
+    dma_channel_configure( m_dataDMA, &c, m_pwm.ccRegister(), s_cycleTable, 1, false );
+
+    c = dma_channel_get_default_config( m_paceDMA );
+    channel_config_set_transfer_data_size( &c, DMA_SIZE_32 );
+    channel_config_set_read_increment( &c, false );
+    channel_config_set_write_increment( &c, false );
+    channel_config_set_dreq( &c, dma_get_timer_dreq( m_timer ) );
+    channel_config_set_chain_to( &c, m_dataDMA );
+    dma_channel_configure( m_paceDMA, &c, &s_paceDummy, &s_paceDummy, ticks, false );
+
+    dma_channel_start( m_dataDMA );
+    return true;
+}
+
+void CPWMCycler::stop() {
+    if( m_dataDMA < 0 )
+        return;
+
+    //
+    // Break the chain before aborting, or one channel can restart the other
+    //
+    const int channels[] = { m_dataDMA, m_paceDMA };
+    for( const int ch : channels ) {
+        dma_channel_config c = dma_get_channel_config( ch );
+        channel_config_set_chain_to( &c, ch );
+        dma_channel_set_config( ch, &c, false );
+    }
+    dma_channel_abort( m_paceDMA );
+    dma_channel_abort( m_dataDMA );
+
+    //
+    // Tell the PWM where we stopped, so whatever drives it next starts from there
+    //
+    const uint next = (dma_hw->ch[ m_dataDMA ].read_addr - uintptr_t( s_cycleTable )) / sizeof(uint32_t);
+    m_pwm.setPercent( percentAt( (next + TABLE_SIZE - 1) % TABLE_SIZE ) );
+    m_pwm.setDither( m_wasDithering );
+
+    dma_channel_unclaim( m_paceDMA );
+    dma_channel_unclaim( m_dataDMA );
+    dma_timer_unclaim( m_timer );
+    m_dataDMA = m_paceDMA = m_timer = -1;
+    s_cycleOwner = nullptr;
+}
+
+//
+// CDebouncer.  All of them share one copy of the program on pio0, a state machine each
+//
+CDebouncer::CDebouncer( CGPIO_IN& gpio, uint32_t settleUs, uint32_t sampleHz ) :
+    m_gpio( gpio ),
+    m_settleUs( settleUs ),
+    m_samples( MAX( uint32_t( uint64_t(settleUs) * sampleHz / 1000000 ), 1u ) ),
+    m_sampleHz( sampleHz )
+{
+    if( !m_gpio.available() )
+        return;
+
+    m_sm = pio_claim_unused_sm( pio0, true );
+    if( m_programUsers++ == 0 )
+        m_programOffset = pio_add_program( pio0, &debounce_program );
+}
+
+CDebouncer::~CDebouncer() {
+    if( m_sm < 0 )
+        return;
+
+    disable( m_level );
+    pio_sm_unclaim( pio0, m_sm );
+    if( --m_programUsers == 0 )
+        pio_remove_program( pio0, &debounce_program, m_programOffset );
+}
+
+void CDebouncer::enable( bool initialLevel ) {
+    if( m_sm < 0 )
+        return;
+
+    CINTERRUPTS_OFF intsOff;
+    m_level = initialLevel;
+
+    pio_sm_config c = debounce_program_get_default_config( m_programOffset );
+    sm_config_set_jmp_pin( &c, m_gpio.pin() );
+    sm_config_set_clkdiv( &c, float( clock_get_hz( clk_sys ) ) / (2.0f * m_sampleHz) );
+
+    const uint start = initialLevel ? debounce_offset_start_high : debounce_offset_start_low;
+    pio_sm_init( pio0, m_sm, m_programOffset + start, &c );
+    pio_sm_put( pio0, m_sm, m_samples - 1 );            // the program's first pull; keep the TX FIFO unjoined for it
+
+    m_owners[ m_sm ] = this;
+    pio_set_irq0_source_enabled( pio0, pio_interrupt_source( pis_sm0_rx_fifo_not_empty + m_sm ), true );
+    irq_set_exclusive_handler( PIO0_IRQ_0, onFIFO );
+    irq_set_enabled( PIO0_IRQ_0, true );
+    pio_sm_set_enabled( pio0, m_sm, true );
+}
+
+void CDebouncer::disable( bool restingLevel ) {
+    if( m_sm < 0 )
+        return;
+
+    CINTERRUPTS_OFF intsOff;
+    pio_sm_set_enabled( pio0, m_sm, false );
+    pio_set_irq0_source_enabled( pio0, pio_interrupt_source( pis_sm0_rx_fifo_not_empty + m_sm ), false );
+    pio_sm_clear_fifos( pio0, m_sm );
+    m_owners[ m_sm ] = nullptr;
+    m_level = restingLevel;
+}
+
+//
+// The state machine only pushes on a change, but we may have been told the level at enable() and be wrong
+//
+void CDebouncer::onFIFO() {
+    for( uint sm = 0; sm < NUM_PIO_STATE_MACHINES; ++sm ) {
+        CDebouncer *d = m_owners[ sm ];
+        while( !pio_sm_is_rx_fifo_empty( pio0, sm ) ) {
+            const bool level = pio_sm_get( pio0, sm ) != 0;
+            if( d == nullptr || level == d->m_level )
+                continue;
+            d->m_level = level;
+            d->m_changedAt = from_us_since_boot( time_us_64() - d->m_settleUs );
+            d->onChange( level );
+        }
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+#include "hardware/pio.h"
+static const uint16_t debounce_program_instructions[1] = {0};
+static const pio_program_t debounce_program = { debounce_program_instructions, 1, -1 };
+#define debounce_offset_start_low 0u
+#define debounce_offset_start_high 2u
+static inline pio_sm_config debounce_program_get_default_config(uint offset) { pio_sm_config c{}; (void)offset; return c; }
@@ -0,0 +1,35 @@
+#pragma once
+#include "pico/stdlib.h"
+enum dma_channel_transfer_size { DMA_SIZE_8 = 0, DMA_SIZE_16 = 1, DMA_SIZE_32 = 2 };
+typedef struct { uint32_t ctrl; } dma_channel_config;
+int dma_claim_unused_channel(bool required);
+void dma_channel_unclaim(uint);
+dma_channel_config dma_channel_get_default_config(uint);
+void channel_config_set_transfer_data_size(dma_channel_config*, enum dma_channel_transfer_size);
+void channel_config_set_read_increment(dma_channel_config*, bool);
+void channel_config_set_write_increment(dma_channel_config*, bool);
+void channel_config_set_dreq(dma_channel_config*, uint);
+void channel_config_set_chain_to(dma_channel_config*, uint);
+void channel_config_set_ring(dma_channel_config*, bool, uint);
+void dma_channel_configure(uint, const dma_channel_config*, volatile void*, const volatile void*, uint, bool);
+void dma_channel_set_read_addr(uint, const volatile void*, bool);
+void dma_channel_set_trans_count(uint, uint32_t, bool);
+void dma_channel_abort(uint);
+bool dma_channel_is_busy(uint);
+void dma_channel_start(uint);
+void dma_channel_set_irq0_enabled(uint, bool);
+void dma_channel_acknowledge_irq0(uint);
+bool dma_channel_get_irq0_status(uint);
+#define DMA_IRQ_0 11
+#define DREQ_PWM_WRAP0 24
+int dma_claim_unused_timer(bool required);
+void dma_timer_unclaim(uint);
+void dma_timer_set_fraction(uint, uint16_t, uint16_t);
+uint dma_get_timer_dreq(uint);
+void dma_channel_set_config(uint, const dma_channel_config*, bool);
+void dma_channel_set_write_addr(uint, volatile void*, bool);
+#define DREQ_FORCE 63
+typedef struct { volatile uint32_t read_addr, write_addr, transfer_count, ctrl_trig, al1_ctrl, al1_read_addr, al1_write_addr, al1_transfer_count_trig; } dma_channel_hw_t;
+typedef struct { dma_channel_hw_t ch[12]; } dma_hw_t;
+extern dma_hw_t *dma_hw;
+dma_channel_config dma_get_channel_config(uint);
@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+typedef unsigned int uint;
+enum gpio_drive_strength { GPIO_DRIVE_STRENGTH_2MA, GPIO_DRIVE_STRENGTH_4MA, GPIO_DRIVE_STRENGTH_8MA, GPIO_DRIVE_STRENGTH_12MA };
+enum gpio_function { GPIO_FUNC_I2C, GPIO_FUNC_PWM, GPIO_FUNC_SIO, GPIO_FUNC_PIO0, GPIO_FUNC_PIO1, GPIO_FUNC_NULL };
+enum gpio_irq_level { GPIO_IRQ_LEVEL_LOW=1, GPIO_IRQ_LEVEL_HIGH=2, GPIO_IRQ_EDGE_FALL=4, GPIO_IRQ_EDGE_RISE=8 };
+typedef void (*gpio_irq_callback_t)(uint, uint32_t);
+void gpio_init(uint); void gpio_set_dir(uint,bool); void gpio_put(uint,bool); bool gpio_get(uint);
+void gpio_pull_up(uint); void gpio_pull_down(uint); void gpio_disable_pulls(uint);
+void gpio_set_drive_strength(uint, enum gpio_drive_strength); void gpio_set_function(uint, enum gpio_function);
+void gpio_set_irq_enabled_with_callback(uint, uint32_t, bool, gpio_irq_callback_t);
+void gpio_set_irq_enabled(uint, uint32_t, bool);
+void gpio_set_irq_callback(gpio_irq_callback_t);
+void gpio_acknowledge_irq(uint, uint32_t);
+void gpio_add_raw_irq_handler(uint, void(*)());
+void gpio_set_dormant_irq_enabled(uint, uint32_t, bool);
+uint32_t gpio_get_all();
+void gpio_set_input_enabled(uint,bool);
+#define IO_IRQ_BANK0 13
+#define NUM_BANK0_GPIOS 30
+#ifndef GPIO_OUT
+#define GPIO_OUT 1
+#define GPIO_IN 0
+#endif
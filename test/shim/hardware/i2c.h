@@ -0,0 +1,29 @@
+#pragma once
+#include "pico/stdlib.h"
+typedef struct i2c_inst i2c_inst_t; extern i2c_inst_t *i2c0, *i2c1;
+uint i2c_init(i2c_inst_t*, uint); void i2c_deinit(i2c_inst_t*); uint i2c_set_baudrate(i2c_inst_t*, uint);
+int i2c_write_timeout_us(i2c_inst_t*, uint8_t, const uint8_t*, size_t, bool, uint);
+int i2c_read_timeout_us(i2c_inst_t*, uint8_t, uint8_t*, size_t, bool, uint);
+int i2c_write_blocking(i2c_inst_t*, uint8_t, const uint8_t*, size_t, bool);
+uint i2c_hw_index(i2c_inst_t*);
+uint i2c_get_dreq(i2c_inst_t*, bool);
+typedef struct { volatile uint32_t con, tar, sar, _p0, data_cmd, ss_scl_hcnt, ss_scl_lcnt, fs_scl_hcnt, fs_scl_lcnt, _p1[2], intr_stat, intr_mask, raw_intr_stat, rx_tl, tx_tl, clr_intr, clr_rx_under, clr_rx_over, clr_tx_over, clr_rd_req, clr_tx_abrt, clr_rx_done, clr_activity, clr_stop_det, clr_start_det, clr_gen_call, enable, status, txflr, rxflr, sda_hold, tx_abrt_source, slv_data_nack_only, dma_cr, dma_tdlr, dma_rdlr, sda_setup, ack_general_call, enable_status, fs_spklen, _p2, clr_restart_det; } i2c_hw_t;
+i2c_hw_t *i2c_get_hw(i2c_inst_t*);
+#define I2C_IC_DATA_CMD_STOP_BITS 0x200u
+#define I2C_IC_DATA_CMD_RESTART_BITS 0x400u
+#define I2C_IC_DATA_CMD_CMD_BITS 0x100u
+#define I2C_IC_DMA_CR_TDMAE_BITS 2u
+#define I2C_IC_DMA_CR_RDMAE_BITS 1u
+#define I2C_IC_RAW_INTR_STAT_TX_ABRT_BITS 0x40u
+#define I2C_IC_RAW_INTR_STAT_STOP_DET_BITS 0x200u
+#define I2C_IC_TX_TL_RESET 0
+#define I2C_IC_STATUS_TFNF_BITS 2u
+#define I2C_IC_STATUS_ACTIVITY_BITS 1u
+#define i2c_get_write_available(i) 16
+bool i2c_get_read_available(i2c_inst_t*);
+#define I2C0_IRQ 23
+#define I2C1_IRQ 24
+#define I2C_IC_INTR_MASK_M_STOP_DET_BITS 0x200u
+#define I2C_IC_INTR_MASK_M_TX_ABRT_BITS 0x40u
+#define I2C_IC_INTR_MASK_M_TX_EMPTY_BITS 0x10u
+#define I2C_IC_RAW_INTR_STAT_TX_EMPTY_BITS 0x10u
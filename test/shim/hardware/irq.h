@@ -0,0 +1,6 @@
+#pragma once
+typedef void (*irq_handler_t)(void);
+void irq_set_exclusive_handler(unsigned num, irq_handler_t handler);
+void irq_set_enabled(unsigned num, bool enabled);
+#define SIO_IRQ_PROC0 15
+#define SIO_IRQ_PROC1 16
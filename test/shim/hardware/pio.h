@@ -0,0 +1,18 @@
+#pragma once
+#include "pico/stdlib.h"
+typedef struct pio_hw pio_hw_t; typedef pio_hw_t* PIO;
+extern PIO pio0;
+typedef struct { uint32_t clkdiv, execctrl, shiftctrl, pinctrl; } pio_sm_config;
+typedef struct { const uint16_t* instructions; uint8_t length; int8_t origin; } pio_program_t;
+uint pio_add_program(PIO, const pio_program_t*); void pio_remove_program(PIO, const pio_program_t*, uint);
+int pio_claim_unused_sm(PIO, bool); void pio_sm_unclaim(PIO, uint);
+void pio_sm_init(PIO, uint, uint, const pio_sm_config*); void pio_sm_set_enabled(PIO, uint, bool);
+void pio_sm_put(PIO, uint, uint32_t); uint32_t pio_sm_get(PIO, uint); bool pio_sm_is_rx_fifo_empty(PIO, uint);
+void pio_sm_clear_fifos(PIO, uint);
+enum pio_interrupt_source { pis_sm0_rx_fifo_not_empty = 0 };
+void pio_set_irq0_source_enabled(PIO, enum pio_interrupt_source, bool);
+void sm_config_set_jmp_pin(pio_sm_config*, uint); void sm_config_set_clkdiv(pio_sm_config*, float);
+enum pio_fifo_join { PIO_FIFO_JOIN_NONE, PIO_FIFO_JOIN_TX, PIO_FIFO_JOIN_RX };
+void sm_config_set_fifo_join(pio_sm_config*, enum pio_fifo_join);
+#define PIO0_IRQ_0 7
+#define NUM_PIO_STATE_MACHINES 4
@@ -0,0 +1,18 @@
+#pragma once
+#include "pico/stdlib.h"
+enum pwm_clkdiv_mode { PWM_DIV_FREE_RUNNING };
+uint pwm_gpio_to_slice_num(uint); uint pwm_gpio_to_channel(uint);
+void pwm_set_clkdiv_mode(uint, enum pwm_clkdiv_mode); void pwm_set_clkdiv_int_frac(uint, uint8_t, uint8_t);
+void pwm_set_wrap(uint, uint16_t); void pwm_set_enabled(uint, bool); void pwm_set_chan_level(uint, uint, uint16_t);
+void pwm_set_gpio_level(uint, uint16_t);
+void pwm_clear_irq(uint); void pwm_set_irq_enabled(uint, bool); uint32_t pwm_get_irq_status_mask();
+uint pwm_get_dreq(uint);
+void pwm_set_counter(uint, uint16_t);
+#define PWM_IRQ_WRAP 4
+#define PWM_CHAN_A 0
+#define PWM_CHAN_B 1
+typedef struct { volatile uint32_t csr, div, ctr, cc, top; } pwm_slice_hw_t;
+typedef struct { pwm_slice_hw_t slice[8]; volatile uint32_t en, intr, inte, intf, ints; } pwm_hw_t;
+extern pwm_hw_t *pwm_hw;
+#define NUM_PWM_SLICES 8
+typedef volatile uint32_t io_rw_32;
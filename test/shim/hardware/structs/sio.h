@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+typedef struct { volatile uint32_t cpuid, gpio_in, fifo_st, fifo_wr, fifo_rd; } sio_hw_t;
+extern sio_hw_t *sio_hw;
+#define SIO_FIFO_ST_VLD_BITS 1u
+#define SIO_FIFO_ST_RDY_BITS 2u
@@ -0,0 +1,4 @@
+#pragma once
+#include <stdint.h>
+typedef struct { volatile uint32_t timerawh, timerawl; } timer_hw_t;
+extern timer_hw_t *timer_hw;
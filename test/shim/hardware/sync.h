@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+typedef unsigned int uint;
+uint32_t save_and_disable_interrupts(); void restore_interrupts(uint32_t);
+typedef struct spin_lock { uint32_t v; } spin_lock_t;
+#define PICO_SPINLOCK_ID_ATOMIC 8
+spin_lock_t *spin_lock_instance(unsigned); unsigned spin_lock_claim_unused(bool);
+uint32_t spin_lock_blocking(spin_lock_t*); void spin_unlock(spin_lock_t*, uint32_t);
+uint next_striped_spin_lock_num();
@@ -0,0 +1,11 @@
+#pragma once
+#include "pico/stdlib.h"
+typedef void (*hardware_alarm_callback_t)(uint alarm_num);
+int hardware_alarm_claim_unused(bool required);
+void hardware_alarm_claim(uint);
+void hardware_alarm_set_callback(uint, hardware_alarm_callback_t);
+bool hardware_alarm_set_target(uint, absolute_time_t);
+void hardware_alarm_cancel(uint);
+void hardware_alarm_force_irq(uint);
+#define NUM_TIMERS 4
+void hardware_alarm_unclaim(uint);
@@ -0,0 +1,4 @@
+#pragma once
+typedef struct { int x; } critical_section_t;
+void critical_section_init(critical_section_t*); void critical_section_deinit(critical_section_t*);
+void critical_section_enter_blocking(critical_section_t*); void critical_section_exit(critical_section_t*);
@@ -0,0 +1,13 @@
+#pragma once
+#include "pico/stdlib.h"
+void multicore_launch_core1(void (*entry)(void));
+void multicore_launch_core1_with_stack(void (*entry)(void), uint32_t *stack_bottom, size_t stack_size_bytes);
+void multicore_lockout_victim_init(void);
+bool multicore_lockout_victim_is_initialized(uint core_num);
+void multicore_lockout_start_blocking(void);
+void multicore_lockout_end_blocking(void);
+bool multicore_lockout_start_timeout_us(uint64_t);
+bool multicore_lockout_end_timeout_us(uint64_t);
+void multicore_reset_core1(void);
+static inline void multicore_fifo_push_blocking(uint32_t){}
+static inline uint32_t multicore_fifo_pop_blocking(){return 0;}
@@ -0,0 +1,4 @@
+#pragma once
+#include "pico/stdio/driver.h"
+extern stdio_driver_t stdio_usb;
+bool stdio_usb_connected(void);
@@ -0,0 +1,63 @@
+#pragma once
+
+//
+// Host stand-ins for the parts of the Pico SDK the tests compile against.  Just enough to build the
+//   sources in ../src with g++; what the tests link against is defined in shim.cpp
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <string.h>
+typedef unsigned int uint;
+typedef uint64_t absolute_time_t;
+static const absolute_time_t nil_time = 0;
+static const absolute_time_t at_the_end_of_time = ~0ull;
+#define PICO_ERROR_TIMEOUT -1
+#define PICO_ERROR_GENERIC -1
+#define PICO_DEFAULT_LED_PIN 25
+#define __force_inline inline
+#define __not_in_flash_func(x) x
+#define __time_critical_func(x) x
+#define __scratch_x(x)
+#define __scratch_y(x)
+#define __no_inline_not_in_flash_func(x) x
+#define __isr
+#define MIN(a,b) ((b)<(a)?(b):(a))
+#define MAX(a,b) ((a)<(b)?(b):(a))
+extern unsigned char shim_flash[];          // stands in for the XIP window onto flash
+#define XIP_BASE ((uintptr_t)shim_flash)
+#define PICO_FLASH_SIZE_BYTES (2*1024*1024)
+#define count_of(a) (sizeof(a)/sizeof((a)[0]))
+absolute_time_t get_absolute_time();
+int64_t absolute_time_diff_us(absolute_time_t, absolute_time_t);
+absolute_time_t make_timeout_time_us(uint64_t);
+absolute_time_t make_timeout_time_ms(uint32_t);
+absolute_time_t delayed_by_us(absolute_time_t, uint64_t);
+absolute_time_t delayed_by_ms(absolute_time_t, uint32_t);
+uint64_t to_us_since_boot(absolute_time_t);
+uint32_t to_ms_since_boot(absolute_time_t);
+absolute_time_t from_us_since_boot(uint64_t);
+uint64_t time_us_64();
+uint32_t time_us_32();
+bool time_reached(absolute_time_t);
+bool is_nil_time(absolute_time_t);
+void sleep_ms(uint32_t); void sleep_us(uint64_t); void busy_wait_us(uint64_t); void busy_wait_us_32(uint32_t);
+void stdio_init_all(); int getchar_timeout_us(uint32_t); int putchar_raw(int);
+void tight_loop_contents();
+static inline void __wfi(){} static inline void __wfe(){} static inline void __sev(){} static inline void __dmb(){ __atomic_thread_fence(__ATOMIC_SEQ_CST); } static inline void __compiler_memory_barrier(){}
+typedef struct repeating_timer { void *user_data; } repeating_timer_t;
+typedef bool (*repeating_timer_callback_t)(repeating_timer_t*);
+bool add_repeating_timer_ms(int32_t, repeating_timer_callback_t, void*, repeating_timer_t*);
+bool add_repeating_timer_us(int64_t, repeating_timer_callback_t, void*, repeating_timer_t*);
+bool cancel_repeating_timer(repeating_timer_t*);
+typedef int32_t alarm_id_t;
+typedef int64_t (*alarm_callback_t)(alarm_id_t, void*);
+alarm_id_t add_alarm_at(absolute_time_t, alarm_callback_t, void*, bool);
+alarm_id_t add_alarm_in_us(uint64_t, alarm_callback_t, void*, bool);
+alarm_id_t add_alarm_in_ms(uint32_t, alarm_callback_t, void*, bool);
+bool cancel_alarm(alarm_id_t);
+#include "hardware/gpio.h"
+#include "hardware/timer.h"
+static inline uint get_core_num(){return 0;}
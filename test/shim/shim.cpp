@@ -0,0 +1,130 @@
+#include <chrono>
+#include <mutex>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+#include "pico/critical_section.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/timer.h"
+
+//
+// Masking interrupts is how the sources get atomicity on the single core they run on.  With host threads
+//   standing in for the ISRs, one lock taken for the duration gives the same guarantee
+//
+static std::recursive_mutex s_interrupts;
+
+uint32_t save_and_disable_interrupts()  { s_interrupts.lock(); return 0; }
+void restore_interrupts( uint32_t )     { s_interrupts.unlock(); }
+
+unsigned char shim_flash[ PICO_FLASH_SIZE_BYTES ];
+
+//
+// Time is the host's monotonic clock, in microseconds since the first call
+//
+uint64_t time_us_64() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast< std::chrono::microseconds >( std::chrono::steady_clock::now() - start ).count();
+}
+uint32_t time_us_32()                                       { return uint32_t( time_us_64() ); }
+absolute_time_t get_absolute_time()                         { return time_us_64(); }
+int64_t absolute_time_diff_us( absolute_time_t from, absolute_time_t to )   { return int64_t( to - from ); }
+absolute_time_t make_timeout_time_us( uint64_t us )        { return time_us_64() + us; }
+absolute_time_t make_timeout_time_ms( uint32_t ms )        { return time_us_64() + ms * 1000ull; }
+absolute_time_t delayed_by_us( absolute_time_t t, uint64_t us ) { return t + us; }
+absolute_time_t delayed_by_ms( absolute_time_t t, uint32_t ms ) { return t + ms * 1000ull; }
+uint64_t to_us_since_boot( absolute_time_t t )              { return t; }
+uint32_t to_ms_since_boot( absolute_time_t t )              { return uint32_t( t / 1000 ); }
+absolute_time_t from_us_since_boot( uint64_t us )           { return us; }
+bool time_reached( absolute_time_t t )                      { return time_us_64() >= t; }
+bool is_nil_time( absolute_time_t t )                       { return t == nil_time; }
+void tight_loop_contents()                                  {}
+
+//
+// A critical section is the interrupt lock again; the tests don't need them told apart
+//
+void critical_section_init( critical_section_t * )          {}
+void critical_section_deinit( critical_section_t * )        {}
+void critical_section_enter_blocking( critical_section_t * ) { s_interrupts.lock(); }
+void critical_section_exit( critical_section_t * )          { s_interrupts.unlock(); }
+
+//
+// A board with nothing attached.  The tests report no pins (HAL::pinNumber()), so the classes leave the
+//   peripherals alone; these only have to link, and read back something harmless if they are asked
+//
+uint32_t clock_get_hz( enum clock_index )                   { return 125000000; }
+
+void gpio_init( uint )                                      {}
+void gpio_set_dir( uint, bool )                             {}
+void gpio_put( uint, bool )                                 {}
+bool gpio_get( uint )                                       { return false; }
+void gpio_set_drive_strength( uint, enum gpio_drive_strength ) {}
+void gpio_set_function( uint, enum gpio_function )          {}
+
+static pwm_hw_t s_pwm;
+pwm_hw_t *pwm_hw = &s_pwm;
+uint pwm_gpio_to_slice_num( uint gpio )                     { return (gpio >> 1) & 7; }
+uint pwm_gpio_to_channel( uint gpio )                       { return gpio & 1; }
+void pwm_set_clkdiv_mode( uint, enum pwm_clkdiv_mode )      {}
+void pwm_set_clkdiv_int_frac( uint, uint8_t, uint8_t )      {}
+void pwm_set_wrap( uint, uint16_t )                         {}
+void pwm_set_enabled( uint, bool )                          {}
+void pwm_set_chan_level( uint, uint, uint16_t )             {}
+uint pwm_get_dreq( uint slice )                             { return slice; }
+
+static dma_hw_t s_dma;
+dma_hw_t *dma_hw = &s_dma;
+int dma_claim_unused_channel( bool )                        { return 0; }
+void dma_channel_unclaim( uint )                            {}
+dma_channel_config dma_channel_get_default_config( uint )   { return dma_channel_config{}; }
+dma_channel_config dma_get_channel_config( uint )           { return dma_channel_config{}; }
+void channel_config_set_transfer_data_size( dma_channel_config *, enum dma_channel_transfer_size ) {}
+void channel_config_set_read_increment( dma_channel_config *, bool )    {}
+void channel_config_set_write_increment( dma_channel_config *, bool )   {}
+void channel_config_set_dreq( dma_channel_config *, uint )  {}
+void channel_config_set_chain_to( dma_channel_config *, uint ) {}
+void channel_config_set_ring( dma_channel_config *, bool, uint ) {}
+void dma_channel_configure( uint, const dma_channel_config *, volatile void *, const volatile void *, uint, bool ) {}
+void dma_channel_set_config( uint, const dma_channel_config *, bool ) {}
+void dma_channel_abort( uint )                              {}
+void dma_channel_start( uint )                              {}
+int dma_claim_unused_timer( bool )                          { return 0; }
+void dma_timer_unclaim( uint )                              {}
+void dma_timer_set_fraction( uint, uint16_t, uint16_t )     {}
+uint dma_get_timer_dreq( uint timer )                       { return timer; }
+
+PIO pio0 = nullptr;
+uint pio_add_program( PIO, const pio_program_t * )          { return 0; }
+void pio_remove_program( PIO, const pio_program_t *, uint ) {}
+int pio_claim_unused_sm( PIO, bool )                        { return 0; }
+void pio_sm_unclaim( PIO, uint )                            {}
+void pio_sm_init( PIO, uint, uint, const pio_sm_config * )  {}
+void pio_sm_set_enabled( PIO, uint, bool )                  {}
+void pio_sm_put( PIO, uint, uint32_t )                      {}
+uint32_t pio_sm_get( PIO, uint )                            { return 0; }
+bool pio_sm_is_rx_fifo_empty( PIO, uint )                   { return true; }
+void pio_sm_clear_fifos( PIO, uint )                        {}
+void pio_set_irq0_source_enabled( PIO, enum pio_interrupt_source, bool ) {}
+void sm_config_set_jmp_pin( pio_sm_config *, uint )         {}
+void sm_config_set_clkdiv( pio_sm_config *, float )         {}
+
+void irq_set_exclusive_handler( unsigned, irq_handler_t )   {}
+void irq_set_enabled( unsigned, bool )                      {}
+
+int hardware_alarm_claim_unused( bool )                     { return 0; }
+void hardware_alarm_unclaim( uint )                         {}
+void hardware_alarm_set_callback( uint, hardware_alarm_callback_t ) {}
+bool hardware_alarm_set_target( uint, absolute_time_t )     { return false; }
+void hardware_alarm_cancel( uint )                          {}
+
+//
+// One spinlock will do:  it is the interrupt lock again
+//
+static spin_lock_t s_spinLock;
+spin_lock_t *spin_lock_instance( unsigned )                 { return &s_spinLock; }
+uint32_t spin_lock_blocking( spin_lock_t * )                { return save_and_disable_interrupts(); }
+void spin_unlock( spin_lock_t *, uint32_t saved )           { restore_interrupts( saved ); }
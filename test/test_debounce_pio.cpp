@@ -0,0 +1,343 @@
+//
+// Replay bouncing switch traces through debounce.pio and check which level changes come out.  A small
+//   interpreter runs the program straight from the source, one instruction per PIO clock, with the JMP pin
+//   read from the trace.  The clock is set up as CDebouncer sets it:  two cycles per sample.  This tests the
+//   PIO program only; CDebouncer's side of it (enable(), onFIFO()) needs the hardware.
+//
+// Bounces are runs at a level shorter than the settle time.  They must never produce a change; a level that
+//   holds for longer must produce exactly one, about the settle time after the last bounce
+//
+#include <stdio.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( cond, ... ) do { if( !(cond) ) { ++failures; printf( "FAIL %s:%d: ", __FILE__, __LINE__ ); printf( __VA_ARGS__ ); printf( "\n" ); } } while( 0 )
+
+//
+// The program, assembled from debounce.pio.  Only what it uses is understood; anything else fails the test
+//
+struct instruction_t {
+    enum op_t { JMP, MOV, SET, PUSH, PULL } op;
+    std::string     cond, dst, src;     // jmp's condition, mov's and set's operands
+    std::string     target;             // jmp's label
+    int             value = 0;          // set's value, or jmp's target once resolved
+    bool            block = true;       // push and pull
+};
+
+struct program_t {
+    std::vector< instruction_t >    code;
+    std::map< std::string, int >    labels;
+    int                             wrapTarget = 0;
+    int                             wrap = -1;
+};
+
+static std::string trim( std::string s ) {
+    s.erase( 0, s.find_first_not_of( " \t\r" ) );
+    s.erase( s.find_last_not_of( " \t\r" ) + 1 );
+    return s;
+}
+
+static bool assemble( const char *path, program_t& p ) {
+    std::ifstream in( path );
+    if( !in ) {
+        printf( "can't read %s\n", path );
+        return false;
+    }
+
+    std::string line;
+    for( int lineNo = 1; std::getline( in, line ); ++lineNo ) {
+        line = trim( line.substr( 0, line.find( ';' ) ) );
+        if( line.empty() || line.rfind( ".program", 0 ) == 0 )
+            continue;
+        if( line == ".wrap_target" ) {
+            p.wrapTarget = int( p.code.size() );
+            continue;
+        }
+        if( line == ".wrap" ) {
+            p.wrap = int( p.code.size() ) - 1;
+            continue;
+        }
+        if( line.back() == ':' ) {
+            std::string label = trim( line.substr( 0, line.size() - 1 ) );
+            if( label.rfind( "public ", 0 ) == 0 )
+                label = trim( label.substr( 7 ) );
+            p.labels[ label ] = int( p.code.size() );
+            continue;
+        }
+
+        std::istringstream  words( line );
+        std::string         op, rest;
+        words >> op;
+        std::getline( words, rest );
+        rest = trim( rest );
+        const size_t split = op == "jmp" ? rest.find( ' ' ) : rest.find( ',' );   // jmp [cond] label, mov dst, src
+        const std::string first = trim( rest.substr( 0, split ) );
+        const std::string second = split == std::string::npos ? "" : trim( rest.substr( split + 1 ) );
+
+        instruction_t i;
+        if( rest.find( '[' ) != std::string::npos || rest.find( "side" ) != std::string::npos ) {
+            printf( "%s:%d: delays and side-sets aren't interpreted: %s\n", path, lineNo, line.c_str() );
+            return false;
+        } else if( op == "jmp" ) {
+            i.op = instruction_t::JMP;
+            i.cond = second.empty() ? "" : first;
+            i.target = second.empty() ? first : second;
+            if( i.cond != "" && i.cond != "pin" && i.cond != "y--" && i.cond != "x--" && i.cond != "!x" && i.cond != "!y" ) {
+                printf( "%s:%d: jmp condition isn't interpreted: %s\n", path, lineNo, line.c_str() );
+                return false;
+            }
+        } else if( op == "mov" || op == "set" ) {
+            i.op = op == "mov" ? instruction_t::MOV : instruction_t::SET;
+            i.dst = first;
+            i.src = second;
+            i.value = atoi( second.c_str() );
+        } else if( op == "push" || op == "pull" ) {
+            i.op = op == "push" ? instruction_t::PUSH : instruction_t::PULL;
+            i.block = rest != "noblock";
+        } else {
+            printf( "%s:%d: instruction isn't interpreted: %s\n", path, lineNo, line.c_str() );
+            return false;
+        }
+        p.code.push_back( i );
+    }
+
+    if( p.wrap < 0 )
+        p.wrap = int( p.code.size() ) - 1;
+    for( auto& i : p.code ) {
+        if( i.op != instruction_t::JMP )
+            continue;
+        if( p.labels.count( i.target ) == 0 ) {
+            printf( "%s: no label %s\n", path, i.target.c_str() );
+            return false;
+        }
+        i.value = p.labels[ i.target ];
+    }
+    return true;
+}
+
+//
+// One state machine.  The FIFOs are four deep, as they are unjoined
+//
+struct stateMachine_t {
+    const program_t&        p;
+    int                     pc;
+    uint32_t                x = 0, y = 0, isr = 0, osr = 0;
+    std::deque< uint32_t >  tx, rx;
+
+    stateMachine_t( const program_t& prog, int start ) : p( prog ), pc( start ) {}
+
+    uint32_t& reg( const std::string& name ) {
+        static uint32_t null;
+        null = 0;
+        return name == "x" ? x : name == "y" ? y : name == "isr" ? isr : name == "osr" ? osr : null;
+    }
+
+    void step( bool pin ) {
+        const instruction_t& i = p.code[ pc ];
+        int next = (pc == p.wrap) ? p.wrapTarget : pc + 1;
+
+        switch( i.op ) {
+        case instruction_t::JMP: {
+            bool take = true;
+            if( i.cond == "pin" )       take = pin;
+            else if( i.cond == "!x" )   take = x == 0;
+            else if( i.cond == "!y" )   take = y == 0;
+            else if( i.cond == "x--" )  take = x-- != 0;
+            else if( i.cond == "y--" )  take = y-- != 0;
+            if( take )
+                next = i.value;
+            break;
+        }
+        case instruction_t::MOV:
+            reg( i.dst ) = reg( i.src );
+            break;
+        case instruction_t::SET:
+            reg( i.dst ) = uint32_t( i.value );
+            break;
+        case instruction_t::PUSH:
+            if( rx.size() < 4 ) {
+                rx.push_back( isr );
+                isr = 0;
+            } else if( i.block ) {
+                return;                     // stall
+            }
+            break;
+        case instruction_t::PULL:
+            if( !tx.empty() ) {
+                osr = tx.front();
+                tx.pop_front();
+            } else if( i.block ) {
+                return;
+            } else {
+                osr = x;
+            }
+            break;
+        }
+        pc = next;
+    }
+};
+
+//
+// A trace is the pin's level to start with and the times it changes
+//
+struct trace_t {
+    bool                        initial;
+    std::vector< uint32_t >     edges;          // microseconds, each one toggles the pin
+    uint32_t                    end;
+
+    bool levelAt( double us, size_t& edge ) const {
+        while( edge < edges.size() && edges[ edge ] <= us )
+            ++edge;
+        return initial ^ (edge & 1);
+    }
+};
+
+struct event_t {
+    bool        level;
+    double      us;
+};
+
+static constexpr uint32_t   SAMPLE_HZ = 4000;           // CDebouncer::defaultSampleHz
+static constexpr double     CYCLE_US = 1e6 / (2.0 * SAMPLE_HZ);
+static constexpr double     SAMPLE_US = 2 * CYCLE_US;
+static constexpr double     LATE_US = 6 * CYCLE_US;
+
+//
+// Run the trace through a state machine started as CDebouncer::enable( 'assumed' ) starts it, and collect
+//   what it pushes the way CDebouncer::onFIFO() does:  values that match the level we think we're at are dropped
+//
+static std::vector< event_t > replay( const program_t& p, uint32_t settleUs, bool assumed, const trace_t& trace ) {
+    const uint32_t samples = std::max( uint32_t( uint64_t( settleUs ) * SAMPLE_HZ / 1000000 ), 1u );   // as CDebouncer
+    stateMachine_t sm( p, p.labels.at( assumed ? "start_high" : "start_low" ) );
+    sm.tx.push_back( samples - 1 );
+
+    std::vector< event_t >  events;
+    bool                    level = assumed;
+    size_t                  edge = 0;
+    for( uint64_t cycle = 0; cycle * CYCLE_US < trace.end; ++cycle ) {
+        sm.step( trace.levelAt( cycle * CYCLE_US, edge ) );
+        while( !sm.rx.empty() ) {
+            const bool pushed = sm.rx.front() != 0;
+            sm.rx.pop_front();
+            if( pushed != level )
+                events.push_back( { level = pushed, cycle * CYCLE_US } );
+        }
+    }
+    return events;
+}
+
+//
+// What an ideal debouncer reports:  a change once the pin has been at a new level for settleUs without a break
+//
+static std::vector< event_t > ideal( uint32_t settleUs, bool assumed, const trace_t& trace ) {
+    std::vector< event_t >  events;
+    bool                    level = assumed;
+    for( size_t i = 0; i <= trace.edges.size(); ++i ) {
+        const bool      pin = trace.initial ^ (i & 1);
+        const double    from = i == 0 ? 0 : trace.edges[ i - 1 ];
+        const double    to = i == trace.edges.size() ? trace.end : trace.edges[ i ];
+        if( pin != level && to - from >= settleUs )
+            events.push_back( { level = pin, from + settleUs } );
+    }
+    return events;
+}
+
+//
+// Compare, allowing the program's own sampling to be early or late by 'earlyUs' and 'lateUs'.  It is late by up
+//   to three cycles seeing the first sample of a run, and three more pushing the change
+//
+static void compare( const char *what, const std::vector< event_t >& got, const std::vector< event_t >& want, double earlyUs, double lateUs ) {
+    CHECK( got.size() == want.size(), "%s: %zu changes, expected %zu", what, got.size(), want.size() );
+    for( size_t i = 0; i < got.size() && i < want.size(); ++i ) {
+        CHECK( got[i].level == want[i].level, "%s: change %zu to %d, expected %d", what, i, got[i].level, want[i].level );
+        CHECK( got[i].us >= want[i].us - earlyUs && got[i].us <= want[i].us + lateUs,
+               "%s: change %zu at %.0fus, expected %.0fus", what, i, got[i].us, want[i].us );
+    }
+}
+
+//
+// A switch that moves 'moves' times, bouncing each time:  up to 24 pulses of 'minPulse' to 'maxPulse' microseconds, then
+//   a settled level held for 'minHold' to 'maxHold'.  Some bursts are just a glitch and end where they began
+//
+static trace_t bouncing( std::mt19937& rng, int moves, uint32_t minPulse, uint32_t maxPulse, uint32_t minHold, uint32_t maxHold ) {
+    std::uniform_int_distribution< uint32_t >   pulse( minPulse, maxPulse ), hold( minHold, maxHold );
+    std::uniform_int_distribution< int >        bounces( 0, 12 ), glitch( 0, 3 );
+
+    trace_t     t;
+    uint32_t    now = hold( rng );
+    t.initial = rng() & 1;
+    for( int move = 0; move < moves; ++move ) {
+        int toggles = 2 * bounces( rng ) + (glitch( rng ) != 0);        // odd toggles move the switch
+        while( toggles-- > 0 ) {
+            t.edges.push_back( now );
+            now += toggles ? pulse( rng ) : hold( rng );
+        }
+    }
+    t.end = now;
+    return t;
+}
+
+int main() {
+    program_t p;
+    if( !assemble( DEBOUNCE_PIO, p ) )
+        return 1;
+
+    std::mt19937 rng( 1 );
+    for( uint32_t settleUs : { 5000u, 20000u } ) {          // TRIM_SWITCH_SETTLE_US, CONFIG_BUTTON_SETTLE_US
+        char what[ 80 ];
+
+        //
+        // A pushbutton's press and release:  the contacts chatter for a couple of milliseconds each way
+        //
+        {
+            trace_t t = { true, { 100000, 100040, 100300, 100350, 100900, 101000, 102100,
+                                  400000, 400020, 400600, 400610, 401500, 401800, 403000 }, 800000 };
+            snprintf( what, sizeof(what), "press and release, %uus settle", settleUs );
+            compare( what, replay( p, settleUs, true, t ), ideal( settleUs, true, t ), CYCLE_US, LATE_US );
+        }
+
+        //
+        // Bounces a few samples long or more, settled levels comfortably past the settle time:  every move is
+        //   reported once, the settle time after the last bounce
+        //
+        for( int i = 0; i < 50; ++i ) {
+            const trace_t t = bouncing( rng, 40, uint32_t( 2 * SAMPLE_US ), settleUs - uint32_t( 3 * SAMPLE_US ),
+                                        settleUs + uint32_t( 3 * SAMPLE_US ), 4 * settleUs );
+            snprintf( what, sizeof(what), "bounces, %uus settle, trace %d", settleUs, i );
+            compare( what, replay( p, settleUs, t.initial, t ), ideal( settleUs, t.initial, t ), CYCLE_US, LATE_US );
+        }
+
+        //
+        // Spikes too short to be sampled reliably.  Missing one can only make a change come sooner, by at most
+        //   the length of the burst (25 spikes)
+        //
+        for( int i = 0; i < 50; ++i ) {
+            const trace_t t = bouncing( rng, 40, 1, uint32_t( SAMPLE_US ), settleUs + uint32_t( 3 * SAMPLE_US ), 4 * settleUs );
+            snprintf( what, sizeof(what), "spikes, %uus settle, trace %d", settleUs, i );
+            compare( what, replay( p, settleUs, t.initial, t ), ideal( settleUs, t.initial, t ), 25 * SAMPLE_US, LATE_US );
+        }
+
+        //
+        // Enabled assuming the wrong level:  the real one is reported once it has settled
+        //
+        {
+            const trace_t t = bouncing( rng, 10, uint32_t( 2 * SAMPLE_US ), settleUs - uint32_t( 3 * SAMPLE_US ),
+                                        settleUs + uint32_t( 3 * SAMPLE_US ), 4 * settleUs );
+            snprintf( what, sizeof(what), "wrong initial level, %uus settle", settleUs );
+            compare( what, replay( p, settleUs, !t.initial, t ), ideal( settleUs, !t.initial, t ), CYCLE_US, LATE_US );
+        }
+    }
+
+    printf( "%d failures\n", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+//
+// Check the gauge's spline against the 401-entry table it replaced:  across 0-100% it must move one way only,
+//   hit each calibration knot, and stay close to the table's straight lines between them.  For the default
+//   calibration and a few others, both ways up.
+//
+// "One way only" is to within a count of the spline's Q16 arithmetic (0.000015% duty), which its truncating
+//   shifts can give back on a flat stretch.  The dithered PWM's finest step is over ten times that
+//
+#include <math.h>
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "config.h"
+#include "util.hpp"
+#include "CGauge.hpp"
+
+//
+// No pins, so CPWM keeps the duty cycle it's given and leaves the hardware alone
+//
+int HAL::pinNumber( BoardPin::type_t )      { return -1; }
+
+static int failures = 0;
+
+#define CHECK( cond, ... ) do { if( !(cond) ) { ++failures; printf( "FAIL %s:%d: ", __FILE__, __LINE__ ); printf( __VA_ARGS__ ); printf( "\n" ); } } while( 0 )
+
+//
+// The old map:  401 entries, straight lines between the knots, looked up to the nearest entry
+//
+struct oldMap_t {
+    float map[ 401 ];
+
+    oldMap_t( const CGauge::calType_t& cal ) {
+        const int rangeDelta = (401 - 1) / (cal.size() - 1);
+        for( uint k = 0; k < cal.size() - 1; ++k )
+            for( int i = k * rangeDelta; i <= int( k + 1 ) * rangeDelta; ++i )
+                map[i] = cal[k] + ((i - k * rangeDelta) / float( rangeDelta )) * (cal[k+1] - cal[k]);
+    }
+
+    //
+    // The straight line the table was sampled from, without the lookup's rounding (which used 401 for 400)
+    //
+    static float line( const CGauge::calType_t& cal, float percent ) {
+        const int segment = MIN( int( percent / 25 ), 3 );
+        return cal[segment] + (percent / 25 - segment) * (cal[segment+1] - cal[segment]);
+    }
+
+    float operator()( float percent ) const {
+        int index = int( (percent / 100) * 401 + 0.5f );
+        index = MAX( index, 0 );
+        index = MIN( index, 400 );
+        return map[ index ];
+    }
+};
+
+//
+// The curve bends away from the table's straight lines between the knots.  With Fritsch-Carlson slopes, at most
+//   three times the segment's own, the bend stays under 0.385 of the segment's rise.  On top of that is how far
+//   the table's lookup was from its own line
+//
+static constexpr float  MAX_BEND = 0.385f;
+static constexpr float  Q16_COUNT = 1.0f / 65536;
+
+static void check( const char *name, const CGauge::calType_t& cal ) {
+    CGauge      gauge( cal );
+    oldMap_t    old( cal );
+    const bool  increasing = cal[4] > cal[0];
+    const bool  straight = cal[1] - cal[0] == cal[2] - cal[1] && cal[2] - cal[1] == cal[3] - cal[2] && cal[3] - cal[2] == cal[4] - cal[3];
+
+    float   worst = 0, worstAt = 0, last = NAN;
+    for( int hundredths = 0; hundredths <= 10000; ++hundredths ) {
+        const float percent = hundredths / 100.0f;
+        const float duty = gauge.set( percent ).currentDutyCycle();
+
+        if( !isnan( last ) )
+            CHECK( increasing ? duty >= last - Q16_COUNT : duty <= last + Q16_COUNT, "%s: %.2f%% maps to %.6f, past %.6f at %.2f%%", name, percent, duty,
+                   last, percent - 0.01f );
+        last = duty;
+
+        const int   segment = MIN( hundredths / 2500, 3 );
+        const float rise = fabsf( cal[segment+1] - cal[segment] );
+        const float tableError = fabsf( old( percent ) - oldMap_t::line( cal, percent ) );
+        const float deviation = fabsf( duty - old( percent ) );
+        CHECK( deviation <= MAX_BEND * rise + tableError + Q16_COUNT, "%s: %.2f%% maps to %.4f, the table had %.4f", name, percent,
+               duty, old( percent ) );
+        if( straight )          // the spline is the line, give or take rounding the position to Q16
+            CHECK( fabsf( duty - oldMap_t::line( cal, percent ) ) <= (rise + 4) * Q16_COUNT, "%s: %.2f%% maps to %.4f, off the line at %.4f",
+                   name, percent, duty, oldMap_t::line( cal, percent ) );
+        if( deviation > worst ) {
+            worst = deviation;
+            worstAt = percent;
+        }
+
+        if( hundredths % 2500 == 0 )
+            CHECK( fabsf( duty - cal[ hundredths / 2500 ] ) < 0.001f, "%s: knot %.0f%% maps to %.4f, not %.4f", name, percent, duty,
+                   cal[ hundredths / 2500 ] );
+    }
+    printf( "%-30s worst %.3f%% duty from the table, at %.2f%%\n", name, worst, worstAt );
+}
+
+int main() {
+    //
+    // The cal's bounds are the ones isValidCalibration() checks
+    //
+    static const struct {
+        const char          *name;
+        CGauge::calType_t   cal;
+    } cals[] = {
+        { "default",                { 86.75, 71.25, 61.25, 51.75, 35.25 } },        // CNVState's
+        { "straight line",          { 10, 30, 50, 70, 90 } },
+        { "steep then flat",        { 5, 60, 80, 85, 87 } },
+        { "flat then steep",        { 95, 94, 90, 70, 2 } },
+        { "nearly flat segment",    { 20, 20.5f, 60, 60.25f, 99 } },
+        { "full range",             { 0, 25, 50, 75, 100 } },
+    };
+
+    for( const auto& c : cals ) {
+        CHECK( CGauge::isValidCalibration( c.cal ), "%s isn't a valid calibration", c.name );
+        check( c.name, c.cal );
+
+        CGauge::calType_t reversed;
+        for( uint i = 0; i < c.cal.size(); ++i )
+            reversed[i] = c.cal[ c.cal.size() - 1 - i ];
+        char name[ 64 ];
+        snprintf( name, sizeof(name), "%s, reversed", c.name );
+        check( name, reversed );
+    }
+
+    printf( "%d failures\n", failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+//
+// Stress the CMessage rings:  several producer threads (standing in for the ISRs and the main loop) against
+//   one consumer.  Every message that alloc() hands out must be popped exactly once, in order per producer,
+//   and every alloc() that returns nullptr must show up in the dropped or coalesced counts
+//
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../src/CMessage.cpp"          // for the counters, which are file static
+
+static constexpr int    PRODUCERS = 4;
+static constexpr int    PER_PRODUCER = 200000;
+
+static int failures = 0;
+
+#define CHECK( cond, ... ) do { if( !(cond) ) { ++failures; printf( "FAIL %s:%d: ", __FILE__, __LINE__ ); printf( __VA_ARGS__ ); printf( "\n" ); } } while( 0 )
+
+//
+// What each producer saw come back from alloc()
+//
+struct producerStats_t {
+    uint32_t    refused[ int(CMessage::Type::COUNT) ] = {};
+    uint32_t    queued[ int(CMessage::Type::COUNT) ] = {};
+};
+
+static const CMessage::Type steadyTypes[] = { CMessage::Type::TRIM_TOP_ON, CMessage::Type::USER_COMMAND };   // one per lane
+static const CMessage::Type periodicTypes[] = { CMessage::Type::HEARTBEAT, CMessage::Type::GAUGE_UPDATE };
+
+static void producer( int id, producerStats_t& stats ) {
+    for( int seq = 0; seq < PER_PRODUCER; ) {
+        //
+        // A steady message carries (producer, sequence) and is retried until it gets in, so none go missing
+        //
+        const CMessage::Type t = steadyTypes[ seq & 1 ];
+        if( auto msg = CMessage::alloc( t, (id << 24) | seq ) ) {
+            msg->push();
+            ++stats.queued[ int(t) ];
+            ++seq;
+        } else {
+            ++stats.refused[ int(t) ];
+            std::this_thread::yield();
+        }
+
+        //
+        // Sprinkle in periodic ones, which may coalesce
+        //
+        if( seq % 7 == 0 ) {
+            const CMessage::Type p = periodicTypes[ (seq / 7) & 1 ];
+            if( auto msg = CMessage::alloc( p ) ) {
+                msg->push();
+                ++stats.queued[ int(p) ];
+            } else {
+                ++stats.refused[ int(p) ];
+            }
+        }
+    }
+}
+
+int main() {
+    producerStats_t             stats[ PRODUCERS ];
+    std::atomic< int >          running( PRODUCERS );
+    std::vector< std::thread >  threads;
+
+    for( int id = 0; id < PRODUCERS; ++id )
+        threads.emplace_back( [&, id]() { producer( id, stats[id] ); --running; } );
+
+    //
+    // The consumer:  the main loop
+    //
+    std::vector< std::vector< uint8_t > >  seen( PRODUCERS, std::vector< uint8_t >( PER_PRODUCER, 0 ) );
+    int         lastSeq[ PRODUCERS ][ 2 ];
+    uint32_t    popped[ int(CMessage::Type::COUNT) ] = {};
+    for( auto& l : lastSeq )
+        l[0] = l[1] = -1;
+
+    for( ;; ) {
+        const bool last = (running == 0);           // read before popping, so nothing pushed after is missed
+        CMessage *msg;
+        while( (msg = CMessage::pop()) != nullptr ) {
+            const CMessage::Type t = msg->type();
+            ++popped[ int(t) ];
+
+            if( t == CMessage::Type::TRIM_TOP_ON || t == CMessage::Type::USER_COMMAND ) {
+                const int id = uint32_t( msg->data() ) >> 24;
+                const int seq = msg->data() & 0xFFFFFF;
+                const int lane = (t == CMessage::Type::USER_COMMAND);
+                CHECK( id < PRODUCERS && seq < PER_PRODUCER, "bad data %08x", msg->data() );
+                if( id < PRODUCERS && seq < PER_PRODUCER ) {
+                    CHECK( seen[id][seq] == 0, "producer %d message %d popped twice", id, seq );
+                    seen[id][seq] = 1;
+                    CHECK( seq > lastSeq[id][lane], "producer %d message %d after %d", id, seq, lastSeq[id][lane] );
+                    lastSeq[id][lane] = seq;
+                }
+            }
+            msg->free();
+        }
+        if( last )
+            break;
+        std::this_thread::yield();
+    }
+    for( auto& t : threads )
+        t.join();
+
+    for( int id = 0; id < PRODUCERS; ++id )
+        for( int seq = 0; seq < PER_PRODUCER; ++seq )
+            CHECK( seen[id][seq] == 1, "producer %d message %d lost", id, seq );
+
+    //
+    // The counters account for every refusal:  steady types can only be dropped, periodic ones coalesced or dropped
+    //
+    for( int t = int(CMessage::Type::FREE) + 1; t < int(CMessage::Type::COUNT); ++t ) {
+        uint32_t queued = 0, refused = 0;
+        for( auto& s : stats ) {
+            queued += s.queued[t];
+            refused += s.refused[t];
+        }
+        CHECK( queued == popped[t], "type %d: %u queued, %u popped", t, queued, popped[t] );
+        CHECK( refused == s_dropped[t] + s_coalesced[t], "type %d: %u refused, %u dropped + %u coalesced", t, refused,
+               unsigned( s_dropped[t] ), unsigned( s_coalesced[t] ) );
+        if( !CMessage::coalesces( CMessage::Type(t) ) )
+            CHECK( s_coalesced[t] == 0, "type %d coalesced but doesn't coalesce", t );
+    }
+    CHECK( s_pendingTypes == 0, "pending types %08x left with the rings empty", unsigned( s_pendingTypes ) );
+    CHECK( CMessage::pop() == nullptr, "rings not empty" );
+
+    uint32_t dropped = 0, coalesced = 0;
+    for( int t = 0; t < int(CMessage::Type::COUNT); ++t ) {
+        dropped += s_dropped[t];
+        coalesced += s_coalesced[t];
+    }
+    printf( "%d producers x %d messages: %u dropped (and retried), %u coalesced, %d failures\n",
+            PRODUCERS, PER_PRODUCER, dropped, coalesced, failures );
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+//
+// Cut the power at every byte of a flash program and of a sector erase, and check that the next boot's scan
+//   always comes back with the last record that was fully written.  The old format sector must be read only
+//   when the log holds no good record.
+//
+// The flash is shim_flash[], and flash_range_program() and flash_range_erase() below write it a byte at a
+//   time in address order, counting down a budget of bytes.  When the budget runs out the byte being written
+//   is left half done and the power "fails":  an exception unwinds back to the test, which then reboots
+//
+#include <vector>
+
+#include "../src/CNVFlash.cpp"              // for _changingData and its configBase, which are file static
+
+//
+// What CNVFlash.cpp links against that we don't test here
+//
+CLOCKOUT_OTHER_CORE::CLOCKOUT_OTHER_CORE() : m_parked( false )  {}
+CLOCKOUT_OTHER_CORE::~CLOCKOUT_OTHER_CORE()                     {}
+bool CGauge::isValidCalibration( const calType_t& )             { return true; }
+bool CActuator::isValidMotion( const motion_t& )                { return true; }
+
+struct powerFailed_t {};
+
+static long budget = -1;                    // bytes left before the power fails, -1 for never
+
+static void writeByte( uint8_t& cell, uint8_t value ) {
+    if( budget == 0 ) {
+        cell = value ^ ((cell ^ value) & 0xAA);     // only some of the bits got there
+        throw powerFailed_t();
+    }
+    if( budget > 0 )
+        --budget;
+    cell = value;
+}
+
+void flash_range_program( uint32_t offset, const uint8_t *data, size_t count ) {
+    for( size_t i = 0; i < count; ++i )
+        writeByte( shim_flash[ offset + i ], shim_flash[ offset + i ] & data[i] );
+}
+
+void flash_range_erase( uint32_t offset, size_t count ) {
+    for( size_t i = 0; i < count; ++i )
+        writeByte( shim_flash[ offset + i ], 0xFF );
+}
+
+static int failures = 0;
+
+#define CHECK( cond, ... ) do { if( !(cond) ) { ++failures; fprintf( stderr, "FAIL %s:%d: ", __FILE__, __LINE__ ); fprintf( stderr, __VA_ARGS__ ); fprintf( stderr, "\n" ); } } while( 0 )
+
+typedef _changingData::_d                                                               data_t;
+typedef configBase< data_t, CHANGING_TOP, NV_FLASH_RING_SECTORS, LEGACY_TOP - FLASH_SECTOR_SIZE >    base_t;
+
+static constexpr uint32_t   LOG_START = base_t::offsetInFlash;
+static constexpr uint32_t   LOG_END = CHANGING_TOP;
+static constexpr uint32_t   LEGACY_SECTOR = LEGACY_TOP - 2 * FLASH_SECTOR_SIZE;
+static constexpr int        LEGACY_VALUE = 9999;        // percentTimes100 in the old format sector
+
+static data_t value( int n ) {
+    data_t d;
+    d.reason = n & 3;
+    d.percentTimes100 = n % 10000;              // not setPercent(), whose float rounding can give neighbours the same value
+    return d;
+}
+
+static int valueOf( const data_t& d ) {
+    return d.percentTimes100;
+}
+
+//
+// Power up:  forget what the last scan found and scan again.  Returns the value read, -1 if none
+//
+static int reboot() {
+    budget = -1;
+    base_t::m_scanned = false;
+    base_t::m_valid = false;
+    base_t::m_newest = -1;
+    base_t::m_sequence = 0;
+    base_t base( "TEST" );
+    return base.valid() ? valueOf( base.data() ) : -1;
+}
+
+static bool save( int n ) {
+    base_t  base( "TEST" );
+    data_t  d = value( n );
+    return base.save( &d );
+}
+
+//
+// Blank flash with a good record in the old format sector, and boot from it
+//
+static void format() {
+    memset( shim_flash, 0xFF, PICO_FLASH_SIZE_BYTES );
+    struct {
+        data_t          m_data;
+        CCRC16::type_t  m_crc;
+    } legacy;
+    legacy.m_data = value( LEGACY_VALUE );
+    legacy.m_crc = CCRC16( &legacy.m_data, &legacy.m_data + 1 ).crc();
+    memcpy( &shim_flash[ LEGACY_SECTOR + 100 * sizeof(legacy) ], &legacy, sizeof(legacy) );
+    reboot();
+}
+
+static std::vector< uint8_t > snapshot() {
+    return std::vector< uint8_t >( &shim_flash[ LOG_START ], &shim_flash[ LOG_END ] );
+}
+
+//
+// Starting from the flash as 'before' has it (which last saved 'previous', -1 for nothing), save 'next' with
+//   the power cut after each number of bytes in turn until the save gets all the way through.  A cut that
+//   leaves the flash as the whole save would have (say, while programming the 0xFF after the record) counts as
+//   having saved 'next'.  Returns how many bytes the save wrote
+//
+static long cutEverywhere( const char *what, const std::vector< uint8_t >& before, int previous, int next ) {
+    memcpy( &shim_flash[ LOG_START ], before.data(), before.size() );
+    reboot();
+    save( next );
+    const std::vector< uint8_t > after = snapshot();
+
+    for( long cut = 0; ; ++cut ) {
+        memcpy( &shim_flash[ LOG_START ], before.data(), before.size() );
+        reboot();
+
+        bool finished = false;
+        budget = cut;
+        try {
+            finished = save( next );
+        } catch( powerFailed_t ) {
+        }
+
+        const bool saved = snapshot() == after;
+        const int expect = saved ? valueOf( value( next ) ) : (previous < 0 ? LEGACY_VALUE : valueOf( value( previous ) ));
+        const int got = reboot();
+        CHECK( got == expect, "%s, power cut after %ld bytes: read %d, expected %d", what, cut, got, expect );
+
+        //
+        // Whatever the cut left behind, the log must carry on
+        //
+        CHECK( save( next + 1 ) && reboot() == valueOf( value( next + 1 ) ), "%s, power cut after %ld bytes: log doesn't recover",
+               what, cut );
+        if( finished ) {
+            fprintf( stderr, "%-36s %5ld bytes, cut at each\n", what, cut );
+            return cut;
+        }
+    }
+}
+
+int main() {
+    if( !freopen( "/dev/null", "w", stdout ) )         // save() chats about every record
+        return 1;
+
+    //
+    // An empty log reads the old format sector, and the first record written is read instead
+    //
+    format();
+    CHECK( reboot() == LEGACY_VALUE, "empty log didn't read the old format sector" );
+    cutEverywhere( "first record", snapshot(), -1, 1 );
+
+    //
+    // The first record was written but lost its CRC:  that's an empty log too
+    //
+    format();
+    save( 1 );
+    shim_flash[ LOG_START + 5 ] ^= 0x01;
+    CHECK( reboot() == LEGACY_VALUE, "log without a good record didn't read the old format sector" );
+
+    //
+    // Into the middle of a sector, the first slot of the next sector, and the first slot after the log wraps
+    //   (which erases the oldest sector, full of good records)
+    //
+    format();
+    int n = 1;
+    for( ; n < 100; ++n )
+        save( n );
+    CHECK( cutEverywhere( "mid sector", snapshot(), n - 1, n ) == FLASH_PAGE_SIZE, "mid sector save wrote more than a page" );
+
+    format();
+    for( n = 1; n <= base_t::recordsPerSector; ++n )
+        save( n );
+    CHECK( cutEverywhere( "new sector", snapshot(), n - 1, n ) == FLASH_PAGE_SIZE, "new sector save erased" );
+
+    format();
+    for( n = 1; n <= base_t::numConfigInFlash; ++n )
+        save( n );
+    CHECK( reboot() == valueOf( value( n - 1 ) ), "full log didn't read its newest record" );
+    CHECK( cutEverywhere( "wrap, erasing the oldest sector", snapshot(), n - 1, n ) == FLASH_SECTOR_SIZE + FLASH_PAGE_SIZE,
+           "wrapping save didn't erase a sector" );
+
+    //
+    // The old format sector is only a fallback:  a log holding good records never reads it
+    //
+    for( int i = 0; i < 3 * base_t::recordsPerSector; ++i ) {
+        save( ++n );
+        CHECK( reboot() == valueOf( value( n ) ), "after wrapping, record %d read back as %d", n, reboot() );
+    }
+
+    fprintf( stderr, "%d failures\n", failures );
+    return failures ? 1 : 0;
+}